@@ -1,8 +1,126 @@
 #pragma once
+#include "parking_spaces/node.h"
+
+#include <valhalla/baldr/graphid.h>
 #include <valhalla/mjolnir/osmdata.h>
 
 #include <boost/property_tree/ptree_fwd.hpp>
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
 namespace parking_spaces {
-void correlate_parking_spaces(const boost::property_tree::ptree& pt,
-                              const std::string& parking_nodes_bin);
+
+/**
+ * What the import did with the parking spaces of one local tile
+ */
+struct tile_statistics {
+  valhalla::baldr::GraphId tile_id;
+  // the parking spaces in the tile
+  size_t parking_spaces = 0;
+  // the parking nodes added for them, and their connection edges to the graph
+  size_t parking_nodes = 0;
+  size_t connections = 0;
+  // the allocations the projection of the tile made from its worker's arena, and the blocks the
+  // arena took from the heap for them
+  size_t arena_allocations = 0;
+  size_t heap_allocations = 0;
+  // whether the projection was taken from the projection cache
+  bool cached = false;
+};
+
+struct correlation_result {
+  // the tiles this process added parking nodes to, sorted by tile id
+  std::vector<tile_statistics> tiles;
+  // parking_space_key of the parking spaces without a candidate edge within the search radius for
+  // some access mode, sorted. Node and way ids overlap, so the bare OSM ids would be ambiguous
+  std::vector<uint64_t> failed;
+  // parking spaces outside the tiles of the graph
+  size_t outside = 0;
+  // connections to tiles of other shards that are not next to this one's
+  size_t dropped = 0;
+};
+
+/**
+ * Correlates the parking spaces to the graph in mjolnir.tile_dir, for callers that already have
+ * them in memory
+ */
+correlation_result correlate_parking_spaces(const boost::property_tree::ptree& pt,
+                                            std::span<const parking_space_node> spaces);
+
+/**
+ * Correlates the parking spaces parsed by process_parking_spaces to the graph
+ *
+ * @param parking_nodes_bin the parse output, a sequence of parking_space_node
+ */
+correlation_result correlate_parking_spaces(const boost::property_tree::ptree& pt,
+                                            const std::string& parking_nodes_bin);
+
+/**
+ * Removes all parking nodes and connection edges a previous import added to the tiles in
+ * mjolnir.tile_dir, so the import can be run again without rebuilding the tiles. Only works on
+ * tiles that were not modified after the import, i.e. before the hierarchy stage.
+ *
+ * @return the number of removed parking nodes
+ */
+size_t remove_parking_spaces(const boost::property_tree::ptree& pt);
+
+/**
+ * A change to a single parking space, identified by its OSM id and type
+ */
+struct parking_change {
+  enum class action : uint8_t { add, move, remove };
+
+  action type = action::add;
+  // the new location and level for add and move, only the OSM id is used for remove
+  parking_space_node space = {};
+};
+
+struct patch_result {
+  // the number of tiles that were rewritten
+  size_t tiles = 0;
+  // parking_space_key of the parking spaces that could not be connected within the search radius
+  std::vector<uint64_t> failed;
+  // parking_space_key of the moves and removes of parking spaces that are not known, and of the
+  // adds outside the graph
+  std::vector<uint64_t> rejected;
+};
+
+/**
+ * Keeps all parking spaces and their projections in memory, so that changes to single parking
+ * spaces only rebuild the tiles they affect instead of re-running the whole import.
+ *
+ * Tiles are rebuilt from a pristine copy of the tile set as it was before any parking spaces
+ * were imported, so the patcher works at the same build stage as correlate_parking_spaces: the
+ * rebuilt tiles in mjolnir.tile_dir still have to go through the remaining build stages.
+ *
+ * Not thread safe, changes have to be applied one batch at a time.
+ */
+class tile_patcher {
+public:
+  /**
+   * @param pt           the full config, tiles are written to mjolnir.tile_dir
+   * @param pristine_dir the tile set without parking spaces, it is created from mjolnir.tile_dir
+   *                     if it does not exist yet
+   */
+  tile_patcher(const boost::property_tree::ptree& pt, const std::string& pristine_dir);
+  ~tile_patcher();
+
+  /**
+   * Applies a batch of changes and rebuilds the affected tiles. Adding a known parking space moves
+   * it. The initial import is a batch adding all parking spaces.
+   */
+  patch_result apply(const std::vector<parking_change>& changes);
+
+  /**
+   * @return the number of parking spaces currently known
+   */
+  size_t size() const;
+
+private:
+  struct impl;
+  std::unique_ptr<impl> impl_;
+};
 } // namespace parking_spaces
@@ -1,13 +1,39 @@
 #pragma once
 #include <valhalla/mjolnir/osmnode.h>
+
+#include <cstdint>
+#include <utility>
+
 namespace parking_spaces {
 
+/**
+ * What the parking space was mapped as in OSM. Node and way ids overlap, so the OSM id alone does
+ * not identify a parking space.
+ */
+enum class osm_type : uint8_t { node, way };
+
 struct parking_space_node {
   valhalla::mjolnir::OSMNode node;
   float level;
   float level_precision;
+  // for ways, node holds the way id and the representative point of the way
+  osm_type type = osm_type::node;
 };
 
 static_assert(std::is_trivially_copyable_v<parking_space_node>,
               "parking_space_node must be trivially copyable");
+
+/**
+ * @return a key that is unique across parking spaces mapped as nodes and as ways
+ */
+inline uint64_t parking_space_key(const parking_space_node& space) {
+  return space.node.osmid_ | (static_cast<uint64_t>(space.type) << 63);
+}
+
+/**
+ * @return the OSM id and the type a parking_space_key was made of
+ */
+inline std::pair<uint64_t, osm_type> split_parking_space_key(uint64_t key) {
+  return {key & ~(uint64_t(1) << 63), static_cast<osm_type>(key >> 63)};
+}
 } // namespace parking_spaces
@@ -0,0 +1,127 @@
+#pragma once
+#include "parking_spaces/parking_spaces.h"
+
+#include <valhalla/baldr/graphid.h>
+#include <valhalla/midgard/pointll.h>
+#include <valhalla/midgard/sequence.h>
+
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace parking_spaces {
+
+/**
+ * @return the distance of the cell (x, y) of a 2^16 x 2^16 grid along the Hilbert curve, so cells
+ *         close to each other mostly end up close to each other when sorted by it
+ */
+uint64_t hilbert_key(uint32_t x, uint32_t y);
+
+/**
+ * A parking node as stored in the parking index. The file consists of a parking_index_header,
+ * the directory of non-empty cells, the entries sorted by the Hilbert key of their cell and the
+ * way nodes each parking node is connected to, all little endian and suitably aligned.
+ */
+struct parking_index_entry {
+  // the GraphId value of the parking node
+  uint64_t node_id;
+  uint64_t osm_id;
+  double lng;
+  double lat;
+  // kInvalidLevel if the parking space has no level
+  float level;
+  // the way nodes this parking node is connected to, as GraphId values
+  uint32_t first_way_node;
+  uint32_t way_node_count;
+  // an osm_type, whether osm_id is a node or a way id
+  uint32_t osm_type = 0;
+};
+
+struct parking_index_cell {
+  uint64_t key;
+  uint32_t first_entry;
+  uint32_t entry_count;
+};
+
+struct parking_index_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t hilbert_order;
+  uint64_t cell_count;
+  uint64_t entry_count;
+  uint64_t way_node_count;
+};
+
+static_assert(sizeof(parking_index_entry) == 48, "parking_index_entry must have a fixed layout");
+static_assert(sizeof(parking_index_cell) == 16, "parking_index_cell must have a fixed layout");
+static_assert(sizeof(parking_index_header) == 40, "parking_index_header must have a fixed layout");
+
+/**
+ * Collects the parking nodes while they are added to the tiles and writes the parking index.
+ * Can be fed from several threads.
+ */
+class parking_index_builder {
+public:
+  void add(const parking_index_entry& entry, const std::vector<valhalla::baldr::GraphId>& way_nodes);
+
+  /**
+   * Sorts the parking nodes spatially and writes the index to path
+   */
+  void write(const std::string& path) const;
+
+  size_t size() const;
+
+private:
+  mutable std::mutex lock_;
+  std::vector<parking_index_entry> entries_;
+  std::vector<uint64_t> way_nodes_;
+};
+
+/**
+ * Answers nearest parking node queries from a memory-mapped parking index, without touching the
+ * graph. The index divides the world into a 2^16 x 2^16 grid of cells (roughly 300m at mid
+ * latitudes) ordered along a Hilbert curve, and only stores the cells that contain parking.
+ */
+class parking_index {
+public:
+  explicit parking_index(const std::string& path);
+
+  struct result {
+    const parking_index_entry* entry;
+    // in meters
+    float distance;
+  };
+
+  /**
+   * @param ll           where to search from
+   * @param k            the maximum number of parking nodes to return
+   * @param level        only return parking nodes on this level, kInvalidLevel for any level
+   * @param max_distance the search radius in meters
+   *
+   * @return up to k parking nodes, closest first
+   */
+  std::vector<result> nearest(const valhalla::midgard::PointLL& ll,
+                              size_t k,
+                              float level = kInvalidLevel,
+                              float max_distance = 1000.f) const;
+
+  /**
+   * @return the way nodes the given parking node is connected to
+   */
+  std::vector<valhalla::baldr::GraphId> way_nodes(const parking_index_entry& entry) const;
+
+  size_t size() const {
+    return header_->entry_count;
+  }
+
+private:
+  valhalla::midgard::mem_map<char> file_;
+  const parking_index_header* header_;
+  std::span<const parking_index_cell> cells_;
+  std::span<const parking_index_entry> entries_;
+  std::span<const uint64_t> way_nodes_;
+};
+
+} // namespace parking_spaces
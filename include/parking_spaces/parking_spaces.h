@@ -5,8 +5,44 @@
 
 #include <valhalla/mjolnir/osmnode.h>
 
+#include <string>
+#include <string_view>
+#include <vector>
+
 namespace parking_spaces {
 constexpr float kInvalidLevel = std::numeric_limits<float>::max();
 
+/**
+ * The kind of parking to import. It determines which amenity=* nodes are parsed and which access
+ * modes the parking nodes are connected for (always together with pedestrian access).
+ */
+enum class parking_type : uint8_t { car, bicycle, motorcycle };
+
+/**
+ * @param type one of "car", "bicycle" or "motorcycle"
+ *
+ * @throws std::invalid_argument for any other value
+ */
+parking_type parse_parking_type(std::string_view type);
+
+/**
+ * @return the value of the amenity tag marking this kind of parking
+ */
+std::string_view parking_amenity(parking_type type);
+
+/**
+ * Parses the parking spaces of the configured parking_spaces.type from the OSM files into memory,
+ * keeping only the first occurrence of each OSM id.
+ */
+std::vector<parking_space_node> read_parking_spaces(const boost::property_tree::ptree& config,
+                                                    const std::vector<std::string>& osm_files);
+
 void process_parking_spaces(const boost::property_tree::ptree&, std::string_view);
+
+/**
+ * Parses the OSM files in parallel into a single set of parking spaces, deduplicated by OSM id,
+ * and correlates them to the graph in one pass.
+ */
+void process_parking_spaces(const boost::property_tree::ptree& config,
+                            const std::vector<std::string>& osm_files);
 } // namespace parking_spaces
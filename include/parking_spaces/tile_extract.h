@@ -0,0 +1,68 @@
+#pragma once
+#include <valhalla/baldr/graphid.h>
+#include <valhalla/midgard/sequence.h>
+
+#include <boost/property_tree/ptree_fwd.hpp>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+namespace parking_spaces {
+
+/**
+ * Hands out the directory GraphTileBuilder works in. When the graph is read from a memory-mapped
+ * tile extract (mjolnir.tile_extract), only the tiles we actually modify are unpacked into a
+ * staging directory, and finish() writes them into a new extract, copying all other tiles
+ * byte for byte from the input extract.
+ */
+class tile_extract {
+public:
+  /**
+   * @param pt the full config; extract mode is enabled by parking_spaces.output_extract
+   * @throws std::runtime_error if mjolnir.tile_extract is set without an output extract, unless
+   *         nothing is written (parking_spaces.dry_run), or if an entry of the extract is not a
+   *         regular file behind a single ustar header, like entries with pax or GNU long names
+   */
+  explicit tile_extract(const boost::property_tree::ptree& pt);
+
+  /**
+   * @return whether tiles are read from and written to a tar extract
+   */
+  bool enabled() const {
+    return archive_ != nullptr;
+  }
+
+  /**
+   * @return the directory GraphTileBuilder should read from and store to
+   */
+  const std::string& tile_dir() const {
+    return tile_dir_;
+  }
+
+  /**
+   * Makes sure the given tile is available in tile_dir(). In extract mode the tile is copied out
+   * of the extract the first time it is requested and marked as modified.
+   *
+   * @param tile_id the tile to stage
+   */
+  void stage(const valhalla::baldr::GraphId& tile_id);
+
+  /**
+   * Writes the output extract. Unmodified tiles are copied from the input extract unless
+   * parking_spaces.patch_extract is set, in which case only the modified tiles are written.
+   */
+  void finish();
+
+private:
+  std::string tile_dir_;
+  std::string output_path_;
+  bool patch_only_ = false;
+  std::shared_ptr<valhalla::midgard::tar> archive_;
+
+  std::mutex lock_;
+  std::unordered_set<std::string> modified_;
+};
+
+} // namespace parking_spaces
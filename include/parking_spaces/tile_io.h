@@ -0,0 +1,252 @@
+#pragma once
+#include "parking_spaces/tile_extract.h"
+#include "parking_spaces/tile_journal.h"
+
+#include <valhalla/baldr/graphid.h>
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/mjolnir/graphtilebuilder.h>
+
+#include <boost/property_tree/ptree_fwd.hpp>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace parking_spaces {
+
+/**
+ * A cache of read-only tiles shared by all threads and both phases of the import, so each tile is
+ * held in memory once no matter how many workers look at it. Lookups of cached tiles take no lock;
+ * misses read the tile under the lock of the shared reader and the file lock of the tile, and evict
+ * tiles that were not looked up recently (clock algorithm) until the cached tiles fit the byte
+ * budget again.
+ *
+ * Tiles handed out stay valid for as long as the caller holds on to them, even once evicted.
+ * Evicted tiles are only freed once no lookup is in progress, until then they count against the
+ * budget as well.
+ */
+class tile_cache {
+public:
+  /**
+   * @param pt        the mjolnir config
+   * @param lock      the lock guarding the reader and the cache bookkeeping
+   * @param max_bytes the budget for the cached tiles, a single tile larger than that is still cached
+   */
+  tile_cache(const boost::property_tree::ptree& pt, std::mutex& lock, size_t max_bytes);
+  ~tile_cache();
+
+  /**
+   * @return the tile, nullptr if it does not exist
+   */
+  valhalla::baldr::graph_tile_ptr get(const valhalla::baldr::GraphId& tile_id);
+
+  /**
+   * Drops all cached tiles, for when the tiles were rewritten
+   */
+  void clear();
+
+  /**
+   * @return the lock to hold while reading or writing the file of the tile outside of the cache.
+   *         Tiles share a few locks, so different tiles are mostly read and written in parallel
+   *         while a tile is never read while it is being written.
+   */
+  std::mutex& file_lock(const valhalla::baldr::GraphId& tile_id) {
+    return file_locks_[tile_id.Tile_Base().value % kFileLocks];
+  }
+
+  struct statistics {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t bytes = 0;
+  };
+  statistics stats() const;
+
+private:
+  struct cached_tile {
+    valhalla::baldr::graph_tile_ptr tile;
+    size_t bytes;
+  };
+
+  // one per tile of the hierarchy, like the flat tile cache of GraphReader
+  struct slot {
+    std::atomic<const cached_tile*> tile{nullptr};
+    // set by lookups, cleared by the clock hand
+    std::atomic<bool> referenced{false};
+    std::atomic<bool> missing{false};
+  };
+
+  size_t slot_of(const valhalla::baldr::GraphId& tile_id) const;
+  valhalla::baldr::graph_tile_ptr lookup(const slot& entry);
+  void make_room(size_t bytes);
+  void reclaim();
+
+  static constexpr size_t kFileLocks = 64;
+
+  valhalla::baldr::GraphReader reader_;
+  std::mutex& lock_;
+  std::array<std::mutex, kFileLocks> file_locks_;
+  size_t max_bytes_;
+  std::vector<size_t> level_offsets_;
+  std::unique_ptr<slot[]> slots_;
+  size_t slot_count_ = 0;
+
+  // lookups in progress, evicted tiles are only freed once there are none
+  std::atomic<size_t> readers_{0};
+  // the following are guarded by lock_
+  std::vector<std::pair<size_t, std::unique_ptr<const cached_tile>>> resident_;
+  std::vector<std::unique_ptr<const cached_tile>> retired_;
+  std::vector<size_t> missing_;
+  size_t hand_ = 0;
+  size_t bytes_ = 0;
+  size_t retired_bytes_ = 0;
+
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
+  std::atomic<size_t> evictions_{0};
+};
+
+/**
+ * Hands out the tiles of a phase to the workers. The tiles are ordered along a Hilbert curve and
+ * every worker starts on its own contiguous run of the curve, so the tiles it moves on to share
+ * most of their neighbours with the ones before and still find them in the tile cache. A worker
+ * that is done with its run steals the back half of the longest run left.
+ */
+class tile_schedule {
+public:
+  tile_schedule(std::vector<valhalla::baldr::GraphId> tiles, size_t workers);
+
+  /**
+   * @return the next tile for the worker, nothing once all tiles are handed out. Can be called
+   *         concurrently for different workers.
+   */
+  std::optional<valhalla::baldr::GraphId> next(size_t worker);
+
+  /**
+   * @return a tile source for the prefetcher of the worker
+   */
+  std::function<std::optional<valhalla::baldr::GraphId>()> source(size_t worker) {
+    return [this, worker] { return next(worker); };
+  }
+
+  /**
+   * @return the tiles in curve order
+   */
+  const std::vector<valhalla::baldr::GraphId>& tiles() const {
+    return tiles_;
+  }
+
+private:
+  std::vector<valhalla::baldr::GraphId> tiles_;
+  // the tiles left in each worker's run, begin and end packed into one word so that the worker
+  // and thieves take tiles from it with a single compare and swap
+  std::vector<std::atomic<uint64_t>> runs_;
+};
+
+/**
+ * A tile that was read ahead of time, together with a builder to modify it
+ */
+struct prefetched_tile {
+  valhalla::baldr::GraphId tile_id;
+  valhalla::baldr::graph_tile_ptr tile;
+  std::unique_ptr<valhalla::mjolnir::GraphTileBuilder> builder;
+};
+
+/**
+ * Reads the tiles of one worker in a background thread, staying up to depth tiles ahead of the
+ * worker, so that reading the next tile overlaps with the computation on the current one.
+ */
+class tile_prefetcher {
+public:
+  using tile_source = std::function<std::optional<valhalla::baldr::GraphId>()>;
+  using builder_filter = std::function<bool(const valhalla::baldr::GraphId&)>;
+
+  /**
+   * @param cache        where the tiles are read from
+   * @param extract      where the tile builders read from
+   * @param journal      if not null, the tile builders start from the tiles it stages instead
+   * @param next_tile    the tiles to read, in the order the worker will ask for them, called from
+   *                     the background thread until it returns nothing
+   * @param depth        how many tiles to keep loaded ahead of the worker
+   * @param with_builder which tiles to also load a GraphTileBuilder for
+   */
+  tile_prefetcher(tile_cache& cache,
+                  tile_extract& extract,
+                  tile_journal* journal,
+                  tile_source next_tile,
+                  size_t depth,
+                  builder_filter with_builder);
+  ~tile_prefetcher();
+
+  /**
+   * Blocks until the next tile is loaded and hands it out, nothing once the source is exhausted.
+   * Rethrows any error that occurred while reading.
+   */
+  std::optional<prefetched_tile> next();
+
+private:
+  void run();
+
+  tile_cache& cache_;
+  tile_extract& extract_;
+  tile_journal* journal_;
+  tile_source next_tile_;
+  size_t depth_;
+  builder_filter with_builder_;
+
+  std::mutex queue_lock_;
+  std::condition_variable cv_;
+  std::deque<prefetched_tile> ready_;
+  bool done_ = false;
+  bool stop_ = false;
+  std::exception_ptr error_;
+  std::thread thread_;
+};
+
+/**
+ * Stores finished tiles in a background thread so workers can move on to their next tile.
+ * push() blocks once capacity tiles are waiting to be written, which bounds the memory held by
+ * pending builders. Only the file lock of the tile is held while it is stored, so storing overlaps
+ * with the prefetchers reading other tiles.
+ */
+class tile_writer {
+public:
+  /**
+   * @param cache    whose file locks are taken while storing
+   * @param capacity the maximum number of tiles waiting to be written
+   * @param journal  if not null, stored tiles are committed to it
+   */
+  tile_writer(tile_cache& cache, size_t capacity, tile_journal* journal = nullptr);
+  ~tile_writer();
+
+  void push(std::unique_ptr<valhalla::mjolnir::GraphTileBuilder> builder);
+
+  /**
+   * Waits for all pending tiles to be written and rethrows the first error that occurred.
+   */
+  void finish();
+
+private:
+  void run();
+
+  tile_cache& cache_;
+  size_t capacity_;
+  tile_journal* journal_;
+
+  std::mutex queue_lock_;
+  std::condition_variable cv_;
+  std::deque<std::unique_ptr<valhalla::mjolnir::GraphTileBuilder>> pending_;
+  bool done_ = false;
+  std::exception_ptr error_;
+  std::thread thread_;
+};
+
+} // namespace parking_spaces
@@ -0,0 +1,90 @@
+#pragma once
+#include <valhalla/baldr/graphid.h>
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+namespace parking_spaces {
+
+/**
+ * Records which tiles an import has finished, per phase, so that an import that died can be run
+ * again and picks up where it stopped instead of adding parking nodes twice.
+ *
+ * Before a tile is modified in a phase, its state before that phase is kept in the journal once,
+ * as a hard link where the file system allows it. The tile builder always starts over from a copy
+ * of it in a staging directory, and the stored tile is renamed into mjolnir.tile_dir before the
+ * tile is recorded as done, so a tile in the tile directory is never half written and a tile that
+ * is not recorded as done is simply built again.
+ *
+ * The journal survives the process dying, not the machine losing power: nothing is synced to disk.
+ */
+class tile_journal {
+public:
+  /**
+   * Picks up the journal in dir if an earlier run with the same fingerprint left one, starts a new
+   * one otherwise.
+   *
+   * @param tile_dir    the tiles being imported into
+   * @param dir         where the journal lives, on the same file system as tile_dir
+   * @param fingerprint identifies the parking spaces and options of the import
+   *
+   * @throws std::runtime_error if dir holds the journal of an import of other parking spaces
+   */
+  tile_journal(const std::string& tile_dir, const std::string& dir, uint64_t fingerprint);
+
+  /**
+   * @return whether an earlier run was picked up
+   */
+  bool resumed() const {
+    return resumed_;
+  }
+
+  const std::string& dir() const {
+    return dir_;
+  }
+
+  /**
+   * Starts recording phase 1 or 2
+   */
+  void begin(int phase);
+
+  /**
+   * @return whether the tile was finished in the given phase by this or an earlier run
+   */
+  bool done(int phase, const valhalla::baldr::GraphId& tile_id) const;
+
+  /**
+   * Copies the tile as it was before the current phase into the staging directory, for the tile
+   * builder to start from. Can be called concurrently for different tiles.
+   *
+   * @return the directory the tile builder should read from and store to
+   */
+  const std::string& stage(const valhalla::baldr::GraphId& tile_id);
+
+  /**
+   * Moves the tile stored in the staging directory into the tile directory and records it as done
+   * in the current phase. Can be called concurrently for different tiles.
+   */
+  void commit(const valhalla::baldr::GraphId& tile_id);
+
+  /**
+   * The import is complete, removes the journal
+   */
+  void finish();
+
+private:
+  std::string tile_dir_;
+  std::string dir_;
+  std::string staging_dir_;
+  bool resumed_ = false;
+  int phase_ = 1;
+
+  mutable std::mutex lock_;
+  std::ofstream log_;
+  std::unordered_set<valhalla::baldr::GraphId> done_[2];
+};
+
+} // namespace parking_spaces
@@ -1,28 +1,59 @@
 #include "parking_spaces/correlation.h"
 #include "parking_spaces/node.h"
+#include "parking_spaces/parking_index.h"
 #include "parking_spaces/parking_spaces.h"
+#include "parking_spaces/tile_extract.h"
+#include "parking_spaces/tile_io.h"
+#include "parking_spaces/tile_journal.h"
 
 #include <valhalla/baldr/graphconstants.h>
 #include <valhalla/baldr/graphid.h>
 #include <valhalla/baldr/graphreader.h>
 #include <valhalla/baldr/graphtile.h>
 #include <valhalla/baldr/tilehierarchy.h>
+#include <valhalla/midgard/aabb2.h>
+#include <valhalla/midgard/constants.h>
+#include <valhalla/midgard/distanceapproximator.h>
+#include <valhalla/midgard/encoded.h>
 #include <valhalla/midgard/logging.h>
 #include <valhalla/midgard/pointll.h>
 #include <valhalla/midgard/sequence.h>
 #include <valhalla/midgard/util.h>
 #include <valhalla/mjolnir/bssbuilder.h>
+#include <valhalla/mjolnir/edgeinfobuilder.h>
 #include <valhalla/mjolnir/graphtilebuilder.h>
 #include <valhalla/mjolnir/osmdata.h>
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/range/algorithm.hpp>
 
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
 #include <limits>
+#include <map>
+#include <memory_resource>
 #include <mutex>
+#include <optional>
+#include <set>
+#include <span>
+#include <string_view>
 #include <thread>
 #include <tuple>
+#include <type_traits>
+#include <unordered_set>
 #include <vector>
 
 using namespace valhalla::midgard;
@@ -35,6 +66,154 @@ constexpr std::array<uint16_t, 11> kAccessMasks = {kAutoAccess,  kPedestrianAcce
                                                    kTruckAccess, kEmergencyAccess,  kTaxiAccess,
                                                    kBusAccess,   kHOVAccess,        kWheelchairAccess,
                                                    kMopedAccess, kMotorcycleAccess};
+constexpr std::array<std::string_view, kAccessMasks.size()> kAccessNames = {
+    "auto", "pedestrian", "bicycle",    "truck", "emergency",  "taxi",
+    "bus",  "hov",        "wheelchair", "moped", "motorcycle"};
+
+/**
+ * @param spec a shard like "2/8", counting from 1
+ *
+ * @return the shard and the number of shards
+ */
+std::pair<size_t, size_t> parse_shard(const std::string& spec) {
+  const char* begin = spec.data();
+  const char* end = spec.data() + spec.size();
+  const char* slash = std::find(begin, end, '/');
+  size_t shard = 0, shards = 0;
+  bool valid = slash != end && std::from_chars(begin, slash, shard).ptr == slash &&
+               std::from_chars(slash + 1, end, shards).ptr == end && shard >= 1 &&
+               shard <= shards;
+  if (!valid) {
+    throw std::invalid_argument("Expected a shard like 2/8, got: " + spec);
+  }
+  return {shard, shards};
+}
+
+/**
+ * Settings from the parking_spaces section of the config
+ */
+struct correlation_options {
+  // project the parking spaces but leave the tiles untouched
+  bool dry_run = false;
+  // if not empty, the projection results are written to this file as GeoJSON
+  std::string geojson;
+  // the kind of parking and with it the access modes to connect
+  parking_spaces::parking_type type = parking_spaces::parking_type::car;
+  // how far from a parking space to look for edges to connect it to, in meters
+  float search_radius = 100.f;
+  // how many tiles each worker reads ahead of the one it is working on
+  size_t prefetch_tiles = 2;
+  // how many finished tiles may wait to be written before workers block
+  size_t write_queue_size = 8;
+  // tiles with more parking spaces are projected in chunks of this size by several workers
+  size_t projection_chunk_size = 1024;
+  // the budget of the tile cache shared by all workers, in bytes
+  size_t tile_cache_size = 1ul << 30;
+  // Douglas-Peucker tolerance for the connection shapes in meters, 0 keeps the full shape
+  float shape_tolerance = 0.f;
+  // only keep the shape points next to the projected point of the connection shapes
+  bool truncate_shape = false;
+  // where to write the parking index
+  std::string index;
+  // this process only writes the tiles of one of several shards, counting from 1
+  size_t shard = 1;
+  size_t shards = 1;
+  // the unmodified tiles that sharded runs read from
+  std::string pristine_dir;
+  // record the finished tiles so that an import that died can be resumed, at the cost of copying
+  // every tile it modifies once more
+  bool journal = false;
+  std::string journal_dir;
+  // if not empty, projections are kept here and reused by later imports for unchanged tiles
+  std::string projection_cache;
+
+  explicit correlation_options(const boost::property_tree::ptree& pt)
+      : dry_run(pt.get<bool>("parking_spaces.dry_run", false)),
+        geojson(pt.get<std::string>("parking_spaces.geojson", "")),
+        type(parking_spaces::parse_parking_type(pt.get<std::string>("parking_spaces.type", "car"))),
+        search_radius(pt.get<float>("parking_spaces.search_radius", 100.f)),
+        prefetch_tiles(pt.get<size_t>("parking_spaces.prefetch_tiles", 2)),
+        write_queue_size(pt.get<size_t>("parking_spaces.write_queue_size", 8)),
+        projection_chunk_size(
+            std::max<size_t>(pt.get<size_t>("parking_spaces.projection_chunk_size", 1024), 1)),
+        tile_cache_size(pt.get<size_t>("parking_spaces.tile_cache_size",
+                                       pt.get<size_t>("mjolnir.max_cache_size", 1ul << 30))),
+        shape_tolerance(pt.get<float>("parking_spaces.shape_tolerance", 0.f)),
+        truncate_shape(pt.get<bool>("parking_spaces.truncate_shape", false)) {
+    const auto tile_dir = pt.get<std::string>("mjolnir.tile_dir");
+    std::tie(shard, shards) = parse_shard(pt.get<std::string>("parking_spaces.shard", "1/1"));
+    pristine_dir = pt.get<std::string>("parking_spaces.pristine_dir", tile_dir + "_pristine");
+    journal = pt.get<bool>("parking_spaces.journal", false);
+    journal_dir = pt.get<std::string>("parking_spaces.journal_dir", tile_dir + "_journal");
+    projection_cache = pt.get<std::string>("parking_spaces.projection_cache", "");
+    // every shard writes its own index
+    index = pt.get<std::string>("parking_spaces.index",
+                                shards > 1 ? std::format("{}/parking_index_{}.bin", tile_dir, shard)
+                                           : tile_dir + "/parking_index.bin");
+  }
+};
+
+/**
+ * 64-bit FNV-1a, for fingerprints of what an import depends on
+ */
+class fnv1a {
+public:
+  template <class T> void mix(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>, "only plain values can be hashed bytewise");
+    mix_bytes(&value, sizeof(value));
+  }
+
+  // the length goes first, so that neighbouring strings cannot trade characters
+  void mix(std::string_view bytes) {
+    mix(bytes.size());
+    mix_bytes(bytes.data(), bytes.size());
+  }
+
+  void mix(const parking_spaces::parking_space_node& space) {
+    mix(space.node.osmid_);
+    mix(space.node.latlng().lng());
+    mix(space.node.latlng().lat());
+    mix(space.level);
+    mix(space.level_precision);
+    mix(space.type);
+  }
+
+  // the options that change the projection and the connection shapes
+  void mix(const correlation_options& opts) {
+    mix(opts.type);
+    mix(opts.search_radius);
+    mix(opts.shape_tolerance);
+    mix(opts.truncate_shape);
+  }
+
+  uint64_t value() const {
+    return hash_;
+  }
+
+private:
+  void mix_bytes(const void* data, size_t size) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+      hash_ = (hash_ ^ bytes[i]) * 1099511628211ull;
+    }
+  }
+
+  uint64_t hash_ = 14695981039346656037ull;
+};
+
+/**
+ * @return a hash of the parking spaces and of the options that affect the tiles, so a journal is
+ *         only resumed by an import that writes the same tiles
+ */
+uint64_t import_fingerprint(std::span<const parking_spaces::parking_space_node> spaces,
+                            const correlation_options& opts) {
+  fnv1a hash;
+  for (const auto& space : spaces) {
+    hash.mix(space);
+  }
+  hash.mix(opts);
+  return hash.value();
+}
 
 /**
  * For levels we use 7-bit varint encoding, with arbitrary precision stored separately.
@@ -67,12 +246,51 @@ std::string encode_level(const float lvl, const int precision = 0) {
 
 struct BestProjection {
   const DirectedEdge* directededge = nullptr;
-  uint32_t startnode = std::numeric_limits<uint32_t>::max();
+  const GraphTile* tile = nullptr;
+  GraphId edge_id = {};
+  GraphId startnode = {};
   std::vector<PointLL> shape;
   std::tuple<PointLL, float, int> closest;
+
+  // keeps the capacity of the shape for the next parking space
+  void clear() {
+    directededge = nullptr;
+    tile = nullptr;
+    edge_id = {};
+    startnode = {};
+    shape.clear();
+  }
 };
 
-constexpr uint16_t kParkingAccessMask = kVehicularAccess | kPedestrianAccess;
+/**
+ * Compile-time description of a kind of parking.
+ *
+ * @tparam modes  the access modes which each need a candidate edge to connect the parking node to
+ * @tparam access the access set on the parking node and its connection edges
+ */
+template <uint16_t modes, uint16_t access> struct parking_policy {
+  static constexpr auto kModes = [] {
+    std::array<uint16_t, std::popcount(modes)> result{};
+    size_t i = 0;
+    for (const auto access_mask : kAccessMasks) {
+      if (access_mask & modes) {
+        result[i++] = access_mask;
+      }
+    }
+    return result;
+  }();
+  static constexpr uint16_t kModeMask = modes;
+  static constexpr uint16_t kAccess = access;
+};
+
+using car_parking = parking_policy<kAutoAccess | kPedestrianAccess,
+                                   kVehicularAccess | kPedestrianAccess>;
+using bicycle_parking = parking_policy<kBicycleAccess | kPedestrianAccess,
+                                       kBicycleAccess | kPedestrianAccess>;
+using motorcycle_parking = parking_policy<kMotorcycleAccess | kPedestrianAccess,
+                                          kMotorcycleAccess | kPedestrianAccess>;
+
+constexpr std::string_view kSpillDir = "/parking_spill";
 
 /*
  * We store in this struct all information about the bss connections which
@@ -81,12 +299,20 @@ constexpr uint16_t kParkingAccessMask = kVehicularAccess | kPedestrianAccess;
  *  BSS -> waynode
  *  waynode -> BSS
  */
+constexpr uint32_t kNoEdgeInfo = std::numeric_limits<uint32_t>::max();
+
 struct parking_connection {
   OSMNode osm_node = {};
+  parking_spaces::osm_type osm_type = parking_spaces::osm_type::node;
   PointLL bss_ll = {};
   GraphId bss_node_id = {};
   GraphId way_node_id = {};
 
+  // the candidate edge this connection was derived from, and which access modes chose it
+  GraphId candidate_edge = {};
+  PointLL projected_ll = {};
+  uint16_t modes = 0;
+
   uint64_t wayid = std::numeric_limits<uint64_t>::max();
   float level = std::numeric_limits<float>::max();
   float level_precision = std::numeric_limits<float>::max();
@@ -95,6 +321,8 @@ struct parking_connection {
   std::vector<std::string> linguistics = {};
 
   std::vector<PointLL> shape = {};
+  // the length of the full shape in meters, which stays the edge length if the shape is reduced
+  float length = 0.f;
   // Is the outbound edge from the waynode is forward?
   bool is_forward_from_waynode = true;
   uint32_t speed = 0;
@@ -102,8 +330,12 @@ struct parking_connection {
   RoadClass roadclass = RoadClass::kServiceOther;
   Use use = Use::kParkingAisle;
 
-  uint32_t forwardaccess = kParkingAccessMask;
-  uint32_t reverseaccess = kParkingAccessMask;
+  uint32_t forwardaccess = car_parking::kAccess;
+  uint32_t reverseaccess = car_parking::kAccess;
+
+  // the edge info written for the parking -> way node edge, reused by the opposing edge when the
+  // way node is in the same tile
+  uint32_t edgeinfo_offset = kNoEdgeInfo;
 
   parking_connection() = default;
 
@@ -113,7 +345,8 @@ struct parking_connection {
                      const EdgeInfo& edgeinfo,
                      bool is_forward,
                      const BestProjection& best)
-      : osm_node(osm_node), bss_ll(std::move(bss_ll)), way_node_id(way_node_id) {
+      : osm_node(osm_node), bss_ll(std::move(bss_ll)), way_node_id(way_node_id),
+        candidate_edge(best.edge_id), projected_ll(std::get<0>(best.closest)) {
     /*
      * In this constructor: bss_node_id, shapes are left on default value on purpose
      * 	they are to be updated once the bss node is added into the local tile
@@ -130,24 +363,26 @@ struct parking_connection {
     // forwardaccess = best.directededge->forwardaccess();
     // reverseaccess = best.directededge->reverseaccess();
   }
-  // operator < for sorting
+  // operator < for sorting. Phase 1 workers hand in their connections in whatever order they
+  // finish, so ties on the way node are broken by fields that identify the connection itself to
+  // get the same edge order in every run regardless of the thread count
   bool operator<(const parking_connection& other) const {
-    if (way_node_id.tileid() != other.way_node_id.tileid()) {
-      return way_node_id.tileid() < other.way_node_id.tileid();
-    }
-    return way_node_id.id() < other.way_node_id.id();
+    return std::make_tuple(way_node_id.tileid(), way_node_id.id(), bss_node_id.value,
+                           candidate_edge.value, is_forward_from_waynode) <
+           std::make_tuple(other.way_node_id.tileid(), other.way_node_id.id(),
+                           other.bss_node_id.value, other.candidate_edge.value,
+                           other.is_forward_from_waynode);
   }
 };
 
 DirectedEdge make_directed_edge(const GraphId endnode,
-                                const std::vector<PointLL>& shape,
                                 const parking_connection& conn,
                                 const bool is_forward,
                                 const uint32_t localedgeidx) {
   DirectedEdge directededge;
   directededge.set_endnode(endnode);
 
-  directededge.set_length(valhalla::midgard::length(shape));
+  directededge.set_length(conn.length);
   directededge.set_use(conn.use);
   directededge.set_speed(conn.speed);
   directededge.set_surface(conn.surface);
@@ -164,6 +399,279 @@ DirectedEdge make_directed_edge(const GraphId endnode,
   return directededge;
 }
 
+void append_varint(std::string& out, uint64_t value) {
+  while (value > 0x7f) {
+    out.push_back(static_cast<char>(0x80 | (value & 0x7f)));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+void append_strings(std::string& out, const std::vector<std::string>& strings) {
+  append_varint(out, strings.size());
+  for (const auto& str : strings) {
+    append_varint(out, str.size());
+    out.append(str);
+  }
+}
+
+uint64_t read_varint(const char*& pos, const char* end) {
+  uint64_t value = 0;
+  for (int shift = 0; pos < end && shift < 64; shift += 7) {
+    auto byte = static_cast<uint8_t>(*pos++);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+  throw std::runtime_error("Truncated connection spill file");
+}
+
+template <class T> void append_raw(std::string& out, const T& value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <class T> void read_raw(const char*& pos, const char* end, T& value) {
+  if (static_cast<size_t>(end - pos) < sizeof(value)) {
+    throw std::runtime_error("Truncated connection data");
+  }
+  std::memcpy(&value, pos, sizeof(value));
+  pos += sizeof(value);
+}
+
+uint8_t read_byte(const char*& pos, const char* end) {
+  if (pos >= end) {
+    throw std::runtime_error("Truncated connection spill file");
+  }
+  return static_cast<uint8_t>(*pos++);
+}
+
+std::vector<std::string> read_strings(const char*& pos, const char* end) {
+  std::vector<std::string> strings(read_varint(pos, end));
+  for (auto& str : strings) {
+    auto size = read_varint(pos, end);
+    if (static_cast<size_t>(end - pos) < size) {
+      throw std::runtime_error("Truncated connection spill file");
+    }
+    str.assign(pos, size);
+    pos += size;
+  }
+  return strings;
+}
+
+/**
+ * Appends the fields phase 2 needs to create the inbound edge of a connection. Integers are
+ * varint encoded, coordinates are kept as raw doubles so that the tiles come out exactly as if the
+ * connections had never left memory.
+ */
+void encode_connection(const parking_connection& conn, std::string& out) {
+  append_varint(out, conn.way_node_id.value);
+  append_varint(out, conn.bss_node_id.value);
+  append_varint(out, conn.candidate_edge.value);
+  append_varint(out, conn.wayid);
+  out.push_back(static_cast<char>(conn.is_forward_from_waynode));
+  append_varint(out, conn.speed);
+  out.push_back(static_cast<char>(conn.surface));
+  out.push_back(static_cast<char>(conn.roadclass));
+  out.push_back(static_cast<char>(conn.use));
+  append_varint(out, conn.forwardaccess);
+  append_varint(out, conn.reverseaccess);
+  append_varint(out, conn.edgeinfo_offset);
+
+  append_varint(out, conn.shape.size());
+  for (const auto& ll : conn.shape) {
+    const double coords[2] = {ll.lng(), ll.lat()};
+    out.append(reinterpret_cast<const char*>(coords), sizeof(coords));
+  }
+  out.append(reinterpret_cast<const char*>(&conn.length), sizeof(conn.length));
+
+  append_strings(out, conn.names);
+  append_strings(out, conn.tagged_values);
+  append_strings(out, conn.linguistics);
+
+  // what the parking index needs when a resumed import rebuilds it from the spill files
+  append_varint(out, conn.osm_node.osmid_);
+  out.push_back(static_cast<char>(conn.osm_type));
+  const double bss_coords[2] = {conn.bss_ll.lng(), conn.bss_ll.lat()};
+  out.append(reinterpret_cast<const char*>(bss_coords), sizeof(bss_coords));
+  out.append(reinterpret_cast<const char*>(&conn.level), sizeof(conn.level));
+}
+
+parking_connection decode_connection(const char*& pos, const char* end) {
+  parking_connection conn;
+  conn.way_node_id = GraphId(read_varint(pos, end));
+  conn.bss_node_id = GraphId(read_varint(pos, end));
+  conn.candidate_edge = GraphId(read_varint(pos, end));
+  conn.wayid = read_varint(pos, end);
+  conn.is_forward_from_waynode = read_byte(pos, end);
+  conn.speed = read_varint(pos, end);
+  conn.surface = static_cast<Surface>(read_byte(pos, end));
+  conn.roadclass = static_cast<RoadClass>(read_byte(pos, end));
+  conn.use = static_cast<Use>(read_byte(pos, end));
+  conn.forwardaccess = read_varint(pos, end);
+  conn.reverseaccess = read_varint(pos, end);
+  conn.edgeinfo_offset = read_varint(pos, end);
+
+  conn.shape.resize(read_varint(pos, end));
+  for (auto& ll : conn.shape) {
+    double coords[2];
+    if (static_cast<size_t>(end - pos) < sizeof(coords)) {
+      throw std::runtime_error("Truncated connection spill file");
+    }
+    std::memcpy(coords, pos, sizeof(coords));
+    pos += sizeof(coords);
+    ll = PointLL(coords[0], coords[1]);
+  }
+  if (static_cast<size_t>(end - pos) < sizeof(conn.length)) {
+    throw std::runtime_error("Truncated connection spill file");
+  }
+  std::memcpy(&conn.length, pos, sizeof(conn.length));
+  pos += sizeof(conn.length);
+
+  conn.names = read_strings(pos, end);
+  conn.tagged_values = read_strings(pos, end);
+  conn.linguistics = read_strings(pos, end);
+
+  conn.osm_node.osmid_ = read_varint(pos, end);
+  conn.osm_type = static_cast<parking_spaces::osm_type>(read_byte(pos, end));
+  double bss_coords[2];
+  if (static_cast<size_t>(end - pos) < sizeof(bss_coords) + sizeof(conn.level)) {
+    throw std::runtime_error("Truncated connection spill file");
+  }
+  std::memcpy(bss_coords, pos, sizeof(bss_coords));
+  pos += sizeof(bss_coords);
+  conn.bss_ll = PointLL(bss_coords[0], bss_coords[1]);
+  std::memcpy(&conn.level, pos, sizeof(conn.level));
+  pos += sizeof(conn.level);
+  return conn;
+}
+
+/**
+ * Hands the connections from phase 1 to phase 2 through a directory per way node tile, so that
+ * phase 2 only ever holds a single tile's worth of connections in memory. Every parking tile
+ * writes one file into the directory of each way node tile it connects to, in one go and renamed
+ * into place, so a parking tile that is projected again replaces its files instead of adding to
+ * them.
+ */
+class connection_spill {
+public:
+  /**
+   * @param dir  where the files are kept
+   * @param keep whether to pick up the files of an earlier run and leave them behind, for the
+   *             tile journal to resume from
+   */
+  connection_spill(const std::string& dir, bool keep) : dir_(dir), keep_(keep) {
+    if (!keep_) {
+      std::filesystem::remove_all(dir_);
+    }
+    std::filesystem::create_directories(dir_);
+  }
+
+  ~connection_spill() {
+    if (!keep_) {
+      std::error_code ec;
+      std::filesystem::remove_all(dir_, ec);
+    }
+  }
+
+  /**
+   * Writes the connections of a parking tile to the files of their way node tiles. Can be called
+   * concurrently for different parking tiles.
+   */
+  void append(const GraphId& parking_tile, const std::vector<parking_connection>& connections) {
+    std::unordered_map<GraphId, std::string> encoded;
+    for (const auto& conn : connections) {
+      encode_connection(conn, encoded[conn.way_node_id.Tile_Base()]);
+    }
+
+    for (const auto& [tile_id, bytes] : encoded) {
+      auto dir = std::filesystem::path(dir_) / std::to_string(tile_id.value);
+      std::filesystem::create_directories(dir);
+      auto path = dir / (std::to_string(parking_tile.Tile_Base().value) + ".bin");
+      auto tmp = path;
+      tmp += ".tmp";
+      {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), bytes.size());
+        if (!file.flush()) {
+          throw std::runtime_error("Failed to write connection spill file " + path.string());
+        }
+      }
+      std::filesystem::rename(tmp, path);
+    }
+  }
+
+  /**
+   * @return all way node tiles that received connections, in tile id order
+   */
+  std::vector<GraphId> tiles() const {
+    std::vector<GraphId> tiles;
+    for (const auto& entry : std::filesystem::directory_iterator(dir_)) {
+      tiles.emplace_back(std::stoull(entry.path().filename().string()));
+    }
+    std::sort(tiles.begin(), tiles.end());
+    return tiles;
+  }
+
+  /**
+   * Decodes the connections into a single way node tile.
+   */
+  std::vector<parking_connection> read(const GraphId& tile_id) const {
+    std::vector<parking_connection> connections;
+    for (const auto& file : files(tile_id)) {
+      decode_file(file, connections);
+    }
+    return connections;
+  }
+
+  /**
+   * Decodes the connections of the given parking tiles, into any way node tile.
+   */
+  std::vector<parking_connection> read_from(const std::unordered_set<GraphId>& parking_tiles) const {
+    std::vector<parking_connection> connections;
+    for (const auto& tile_id : tiles()) {
+      for (const auto& file : files(tile_id)) {
+        if (parking_tiles.contains(GraphId(std::stoull(file.stem().string())))) {
+          decode_file(file, connections);
+        }
+      }
+    }
+    return connections;
+  }
+
+private:
+  std::vector<std::filesystem::path> files(const GraphId& tile_id) const {
+    std::vector<std::filesystem::path> files;
+    auto dir = std::filesystem::path(dir_) / std::to_string(tile_id.value);
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+      // files still ending in .tmp were never completed
+      if (entry.path().extension() == ".bin") {
+        files.push_back(entry.path());
+      }
+    }
+    return files;
+  }
+
+  static void decode_file(const std::filesystem::path& file,
+                          std::vector<parking_connection>& connections) {
+    auto size = std::filesystem::file_size(file);
+    if (size == 0) {
+      return;
+    }
+    mem_map<char> bytes;
+    bytes.map(file.string(), size, POSIX_MADV_SEQUENTIAL, true);
+
+    const char* pos = bytes.get();
+    const char* end = pos + bytes.size();
+    while (pos < end) {
+      connections.push_back(decode_connection(pos, end));
+    }
+  }
+
+  std::string dir_;
+  bool keep_;
+};
+
 using bss_by_tile_t = std::unordered_map<GraphId, std::vector<parking_spaces::parking_space_node>>;
 
 void compute_and_fill_shape(const BestProjection& best,
@@ -200,6 +708,114 @@ void compute_and_fill_shape(const BestProjection& best,
 
   std::copy(best.shape.begin() + closest_segment + 1, best.shape.end(),
             std::back_inserter(end.shape));
+
+  start.length = valhalla::midgard::length(start.shape);
+  end.length = valhalla::midgard::length(end.shape);
+}
+
+/**
+ * Douglas-Peucker simplification of shape[first, last] in a local equirectangular frame, which is
+ * accurate enough at the extent of a single edge. Marks the points to keep in keep.
+ */
+void simplify_range(const std::vector<PointLL>& shape,
+                    size_t first,
+                    size_t last,
+                    float tolerance,
+                    std::vector<bool>& keep) {
+  const auto& origin = shape[first];
+  const double lng_scale = DistanceApproximator<PointLL>::MetersPerLngDegree(origin.lat());
+  auto to_local = [&](const PointLL& ll) {
+    return std::make_pair((ll.lng() - origin.lng()) * lng_scale,
+                          (ll.lat() - origin.lat()) * kMetersPerDegreeLat);
+  };
+  // the distance from p to the segment a-b in meters
+  auto distance = [&](size_t p, size_t a, size_t b) {
+    auto [px, py] = to_local(shape[p]);
+    auto [ax, ay] = to_local(shape[a]);
+    auto [bx, by] = to_local(shape[b]);
+    double dx = bx - ax, dy = by - ay;
+    double length_sq = dx * dx + dy * dy;
+    double t = length_sq > 0. ? std::clamp(((px - ax) * dx + (py - ay) * dy) / length_sq, 0., 1.)
+                              : 0.;
+    return std::hypot(px - ax - t * dx, py - ay - t * dy);
+  };
+
+  std::vector<std::pair<size_t, size_t>> ranges{{first, last}};
+  while (!ranges.empty()) {
+    auto [a, b] = ranges.back();
+    ranges.pop_back();
+
+    size_t farthest = a;
+    double max_distance = tolerance;
+    for (size_t i = a + 1; i < b; ++i) {
+      auto d = distance(i, a, b);
+      if (d > max_distance) {
+        farthest = i;
+        max_distance = d;
+      }
+    }
+    if (farthest != a) {
+      keep[farthest] = true;
+      ranges.emplace_back(a, farthest);
+      ranges.emplace_back(farthest, b);
+    }
+  }
+}
+
+/**
+ * @return the points of shape that are kept in any case: the end points and the projected point,
+ *         so the connection still meets the road where the parking space was projected to
+ */
+std::vector<bool> shape_anchors(const std::vector<PointLL>& shape, const PointLL& projected_ll) {
+  std::vector<bool> keep(shape.size(), false);
+  keep.front() = keep.back() = true;
+  auto projected = std::find(shape.begin(), shape.end(), projected_ll);
+  if (projected != shape.end()) {
+    keep[std::distance(shape.begin(), projected)] = true;
+  }
+  return keep;
+}
+
+void erase_unkept(std::vector<PointLL>& shape, const std::vector<bool>& keep) {
+  size_t i = 0;
+  std::erase_if(shape, [&](const PointLL&) { return !keep[i++]; });
+}
+
+/**
+ * Reduces the shape of a connection. The edge length was computed from the full shape before and
+ * stays untouched, so costing is not affected.
+ *
+ * @param conn      the connection to reduce the shape of
+ * @param tolerance the Douglas-Peucker tolerance in meters, 0 to disable simplification
+ * @param truncate  whether to drop all road shape points but the ones next to the projected point
+ */
+void reduce_shape(parking_connection& conn, float tolerance, bool truncate) {
+  auto& shape = conn.shape;
+  if (shape.size() <= 2) {
+    return;
+  }
+
+  if (truncate) {
+    auto keep = shape_anchors(shape, conn.projected_ll);
+    for (size_t i = 1; i + 1 < shape.size(); ++i) {
+      if (shape[i] == conn.projected_ll) {
+        keep[i - 1] = keep[i + 1] = true;
+      }
+    }
+    erase_unkept(shape, keep);
+  }
+
+  if (tolerance > 0.f && shape.size() > 2) {
+    // simplify between the anchors so they survive
+    auto keep = shape_anchors(shape, conn.projected_ll);
+    for (size_t first = 0, i = 1; i < shape.size(); ++i) {
+      if (keep[i]) {
+        simplify_range(shape, first, i, tolerance, keep);
+        first = i;
+      }
+    }
+    erase_unkept(shape, keep);
+  }
 }
 
 const static auto VALID_EDGE_USES = std::unordered_set<Use>{
@@ -207,8 +823,363 @@ const static auto VALID_EDGE_USES = std::unordered_set<Use>{
     Use::kPath, Use::kPedestrian,   Use::kAlley,    Use::kServiceRoad,
 };
 
-std::pair<std::vector<parking_connection>, std::vector<size_t>>
-project(const GraphTile& local_tile, const std::vector<parking_spaces::parking_space_node>& osm_bss) {
+struct projection_result {
+  std::vector<parking_connection> connections;
+  // the number of connections for each parking space that was projected successfully
+  std::vector<size_t> counts;
+  // parking spaces for which no candidate edge was found for at least one access mode
+  std::vector<parking_spaces::parking_space_node> failed;
+};
+
+/**
+ * Splits the local tiles into stripes of whole tile columns, one per shard, holding about the same
+ * number of parking spaces each. Every shard computes the same plan from the same parse output, so
+ * the shards agree on who owns which tile without talking to each other.
+ *
+ * A shard writes its own tiles only: the parking tiles in its stripe and the way node tiles their
+ * connections end in. Connections into the stripe from parking tiles in the columns right next to
+ * it are found by projecting those tiles again from the pristine graph, which yields the same
+ * parking node ids their owner assigns. Connections between shards from parking tiles further
+ * away, which needs an edge spanning more than a tile column, are dropped by both sides.
+ */
+class shard_plan {
+public:
+  shard_plan(const bss_by_tile_t& bss_by_tile, size_t shard, size_t shards)
+      : tiles_(TileHierarchy::levels().back().tiles), shard_(shard - 1) {
+    const int32_t columns = tiles_.ncolumns();
+    std::vector<size_t> per_column(columns, 0);
+    size_t total = 0;
+    for (const auto& [tile_id, spaces] : bss_by_tile) {
+      per_column[column(tile_id)] += spaces.size();
+      total += spaces.size();
+    }
+
+    // a stripe ends at the column where the running count reaches its share of the total
+    first_columns_.push_back(0);
+    size_t running = 0;
+    for (int32_t c = 0; c < columns; ++c) {
+      running += per_column[c];
+      while (first_columns_.size() < shards && running * shards >= total * first_columns_.size()) {
+        first_columns_.push_back(c + 1);
+      }
+    }
+    first_columns_.resize(shards, columns);
+    first_columns_.push_back(columns);
+
+    LOG_INFO("Shard {}/{} owns the tile columns {} to {}", shard, shards,
+             first_columns_[shard_], first_columns_[shard_ + 1] - 1);
+  }
+
+  size_t owner(const GraphId& tile_id) const {
+    auto stripe =
+        std::upper_bound(first_columns_.begin(), first_columns_.end(), column(tile_id));
+    return std::distance(first_columns_.begin(), stripe) - 1;
+  }
+
+  bool owns(const GraphId& tile_id) const {
+    return owner(tile_id) == shard_;
+  }
+
+  /**
+   * @return whether the parking spaces of the tile have to be projected by this shard
+   */
+  bool needs(const GraphId& parking_tile) const {
+    return owns(parking_tile) || borders(parking_tile, shard_);
+  }
+
+  /**
+   * Drops the connections between shards that the shard owning the way node tile cannot see, and
+   * the parking spaces left without any connection.
+   *
+   * @return the number of dropped connections
+   */
+  size_t drop_hidden(const GraphId& parking_tile, projection_result& projection) const {
+    std::vector<parking_connection> connections;
+    std::vector<size_t> counts;
+    auto it = projection.connections.begin();
+    for (auto count : projection.counts) {
+      size_t kept = 0;
+      for (auto end = it + count; it != end; ++it) {
+        auto way_node_owner = owner(it->way_node_id);
+        if (way_node_owner == owner(parking_tile) || borders(parking_tile, way_node_owner)) {
+          connections.push_back(std::move(*it));
+          ++kept;
+        }
+      }
+      if (kept > 0) {
+        counts.push_back(kept);
+      }
+    }
+
+    size_t dropped = projection.connections.size() - connections.size();
+    projection.connections = std::move(connections);
+    projection.counts = std::move(counts);
+    return dropped;
+  }
+
+  /**
+   * @return the connections whose way node tile this shard owns, phase 2 ignores all others
+   */
+  std::vector<parking_connection> inbound(const std::vector<parking_connection>& connections) const {
+    std::vector<parking_connection> owned;
+    std::copy_if(connections.begin(), connections.end(), std::back_inserter(owned),
+                 [this](const parking_connection& conn) { return owns(conn.way_node_id); });
+    return owned;
+  }
+
+private:
+  int32_t column(const GraphId& tile_id) const {
+    return tiles_.Col(tile_id.tileid());
+  }
+
+  /**
+   * @return whether the tile lies in a column right next to the stripe of the given shard
+   */
+  bool borders(const GraphId& tile_id, size_t shard) const {
+    auto c = column(tile_id);
+    return owner(tile_id) != shard &&
+           (c + 1 == first_columns_[shard] || c == first_columns_[shard + 1]);
+  }
+
+  Tiles<PointLL> tiles_;
+  size_t shard_;
+  // the first column of every stripe, followed by the number of columns
+  std::vector<int32_t> first_columns_;
+};
+
+using tile_getter_t = std::function<graph_tile_ptr(const GraphId&)>;
+
+/**
+ * Passes allocations on to another resource and counts them
+ */
+class counting_resource : public std::pmr::memory_resource {
+public:
+  explicit counting_resource(std::pmr::memory_resource* upstream) : upstream_(upstream) {
+  }
+
+  size_t allocations() const {
+    return allocations_;
+  }
+
+  void reset() {
+    allocations_ = 0;
+  }
+
+private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    ++allocations_;
+    return upstream_->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    upstream_->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+
+  std::pmr::memory_resource* upstream_;
+  size_t allocations_ = 0;
+};
+
+/**
+ * The scratch memory of one worker. The temporaries of the projection of a tile are allocated
+ * from a monotonic arena that is released as a whole before the next tile, so the heap only sees
+ * the few blocks the arena grows by. Not thread safe, every worker has its own.
+ */
+class tile_arena {
+public:
+  tile_arena()
+      : heap_(std::pmr::new_delete_resource()),
+        arena_(buffer_.get(), kInitialSize, &heap_), counted_(&arena_) {
+  }
+
+  std::pmr::memory_resource* resource() {
+    return &counted_;
+  }
+
+  /**
+   * Frees everything allocated for the previous tile and starts counting again
+   */
+  void reset() {
+    arena_.release();
+    heap_.reset();
+    counted_.reset();
+  }
+
+  // allocations served by the arena since the last reset
+  size_t allocations() const {
+    return counted_.allocations();
+  }
+
+  // blocks the arena took from the heap since the last reset
+  size_t heap_allocations() const {
+    return heap_.allocations();
+  }
+
+private:
+  static constexpr size_t kInitialSize = 64 * 1024;
+
+  std::unique_ptr<std::byte[]> buffer_ = std::make_unique<std::byte[]>(kInitialSize);
+  counting_resource heap_;
+  std::pmr::monotonic_buffer_resource arena_;
+  counting_resource counted_;
+};
+
+/**
+ * Lets the workers that have no tile at hand help with the projection of dense tiles, which would
+ * otherwise keep a single worker busy long after all others are done. The worker of a dense tile
+ * cuts it into tasks and runs them through the pool, the other workers pick them up between their
+ * own tiles and once they have none left. Every worker passes its own arena to the tasks it runs.
+ */
+class projection_pool {
+public:
+  using task_t = std::function<void(tile_arena&)>;
+
+  /**
+   * @param workers the number of workers that will retire from the pool
+   */
+  explicit projection_pool(size_t workers) : working_(workers) {
+  }
+
+  /**
+   * Runs the tasks with the help of the other workers and returns once all of them are done
+   *
+   * @throws the first exception thrown by a task
+   */
+  void run(const std::vector<task_t>& tasks, tile_arena& arena) {
+    if (tasks.size() <= 1) {
+      for (const auto& task : tasks) {
+        task(arena);
+      }
+      return;
+    }
+
+    batch_t batch{tasks};
+    std::unique_lock<std::mutex> l(lock_);
+    batches_.push_back(&batch);
+    cv_.notify_all();
+    // while others finish the last tasks of this batch, tasks of other batches can be done
+    while (batch.done < tasks.size()) {
+      if (!run_one(l, arena)) {
+        cv_.wait(l);
+      }
+    }
+    if (batch.error) {
+      std::rethrow_exception(batch.error);
+    }
+  }
+
+  /**
+   * Runs the tasks of other workers until there are none waiting
+   */
+  void help(tile_arena& arena) {
+    std::unique_lock<std::mutex> l(lock_);
+    while (run_one(l, arena)) {
+    }
+  }
+
+  /**
+   * The worker has no tiles of its own left, it helps the others until all of them retired
+   */
+  void retire(tile_arena& arena) {
+    std::unique_lock<std::mutex> l(lock_);
+    --working_;
+    cv_.notify_all();
+    while (working_ > 0) {
+      if (!run_one(l, arena)) {
+        cv_.wait(l);
+      }
+    }
+  }
+
+private:
+  struct batch_t {
+    const std::vector<task_t>& tasks;
+    // the next task to hand out and the number of finished ones
+    size_t next = 0;
+    size_t done = 0;
+    std::exception_ptr error;
+  };
+
+  /**
+   * Runs the next waiting task without holding the lock
+   *
+   * @return false if no task was waiting
+   */
+  bool run_one(std::unique_lock<std::mutex>& l, tile_arena& arena) {
+    if (batches_.empty()) {
+      return false;
+    }
+    auto* batch = batches_.front();
+    const auto index = batch->next++;
+    // the owner keeps the batch alive until it is done, but it must not be handed out any more
+    if (batch->next == batch->tasks.size()) {
+      batches_.pop_front();
+    }
+
+    l.unlock();
+    std::exception_ptr error;
+    try {
+      batch->tasks[index](arena);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    l.lock();
+
+    if (error && !batch->error) {
+      batch->error = error;
+    }
+    if (++batch->done == batch->tasks.size()) {
+      cv_.notify_all();
+    }
+    return true;
+  }
+
+  std::mutex lock_;
+  std::condition_variable cv_;
+  std::deque<batch_t*> batches_;
+  size_t working_;
+};
+
+/**
+ * @return the local tiles within radius meters of the given point, closest first, together with
+ *         the distance from the point to each tile's bounds
+ */
+std::pmr::vector<std::pair<float, GraphId>>
+tiles_within(const PointLL& ll, float radius, std::pmr::memory_resource* arena) {
+  const auto& level = TileHierarchy::levels().back();
+  auto lat_delta = radius / kMetersPerDegreeLat;
+  auto lng_delta = radius / DistanceApproximator<PointLL>::MetersPerLngDegree(ll.lat());
+  AABB2<PointLL> bbox(ll.lng() - lng_delta, ll.lat() - lat_delta, ll.lng() + lng_delta,
+                      ll.lat() + lat_delta);
+
+  std::pmr::vector<std::pair<float, GraphId>> tiles(arena);
+  for (auto tileid : level.tiles.TileList(bbox)) {
+    auto bounds = level.tiles.TileBounds(tileid);
+    PointLL nearest(std::clamp(ll.lng(), bounds.minx(), bounds.maxx()),
+                    std::clamp(ll.lat(), bounds.miny(), bounds.maxy()));
+    auto distance = static_cast<float>(ll.Distance(nearest));
+    if (distance <= radius) {
+      tiles.emplace_back(distance, GraphId(tileid, level.level, 0));
+    }
+  }
+  std::sort(tiles.begin(), tiles.end());
+  return tiles;
+}
+
+/**
+ * Finds the closest edge for each of the policy's access modes within radius meters of every
+ * parking space in the local tile, looking into neighbouring tiles where the radius reaches them.
+ * Parking spaces without a candidate within the radius for some mode are reported as failed.
+ */
+template <class policy>
+projection_result project(const GraphTile& local_tile,
+                          std::span<const parking_spaces::parking_space_node> osm_bss,
+                          float radius,
+                          const tile_getter_t& get_tile,
+                          std::pmr::memory_resource* arena) {
   auto t1 = std::chrono::high_resolution_clock::now();
   auto scoped_finally = make_finally([&t1, size = osm_bss.size()]() {
     auto t2 = std::chrono::high_resolution_clock::now();
@@ -218,161 +1189,533 @@ project(const GraphTile& local_tile, const std::vector<parking_spaces::parking_s
              std::to_string(secs) + " secs");
   });
 
-  std::vector<parking_connection> res;
-  std::vector<size_t> added_connections_per_bss;
-  auto local_level = TileHierarchy::levels().back().level;
+  projection_result result;
+  auto& res = result.connections;
+  auto& added_connections_per_bss = result.counts;
 
-  std::map<GraphId, size_t> edge_count;
+  // neighbouring tiles are shared by many parking spaces in this tile, so only fetch them once
+  std::pmr::unordered_map<GraphId, graph_tile_ptr> tiles(arena);
+
+  // reused for every edge and parking space, so the shapes only allocate while they grow
+  std::vector<PointLL> this_shape;
+  std::array<BestProjection, policy::kModes.size()> best_projections;
 
-  // In this loop, we try to find the way on which to project the bss node by iterating all nodes in
-  // its corresponding tile... Not a good idea in term of performance... any better idea???
   for (const auto& bss : osm_bss) {
 
     auto bss_ll = bss.node.latlng();
     auto level = bss.level;
 
-    std::array<BestProjection, kAccessMasks.size()> best_projections;
-    std::array<float, kAccessMasks.size()> min_distances;
+    for (auto& proj : best_projections) {
+      proj.clear();
+    }
+    std::array<float, policy::kModes.size()> min_distances;
     min_distances.fill(std::numeric_limits<float>::max());
 
     // Ensures that nearly-equivalent distances result in stable winners
     // across clang/gcc builds.
     auto distanceEpsilon = 0.000001;
 
-    // Loop over all nodes in the tile to find the nearest edge
-    for (uint32_t i = 0; i < local_tile.header()->nodecount(); ++i) {
-      const NodeInfo* node = local_tile.node(i);
-      for (uint32_t j = 0; j < node->edge_count(); ++j) {
-        const DirectedEdge* directededge = local_tile.directededge(node->edge_index() + j);
-        auto edgeinfo = local_tile.edgeinfo(directededge);
-
-        // todo: this filter is in place in the bikesharing correlation; i don't see why we need it
-        // auto found = VALID_EDGE_USES.count(directededge->use());
-        // if (!found) {
-        //   continue;
-        // }
+    for (const auto& [tile_distance, tile_id] : tiles_within(bss_ll, radius, arena)) {
+      // once every mode has a candidate closer than this tile, nothing in it can win
+      if (tile_distance > *std::max_element(min_distances.begin(), min_distances.end())) {
+        break;
+      }
 
-        if ((!(directededge->forwardaccess() & kParkingAccessMask)) || directededge->is_shortcut()) {
-          continue;
-        }
+      auto cached = tiles.find(tile_id);
+      if (cached == tiles.end()) {
+        cached = tiles.emplace(tile_id, tile_id == local_tile.id() ? nullptr : get_tile(tile_id))
+                     .first;
+      }
+      const GraphTile* tile = tile_id == local_tile.id() ? &local_tile : cached->second.get();
+      if (!tile) {
+        continue;
+      }
 
-        auto ei = local_tile.edgeinfo(directededge);
+      // Loop over all nodes in the tile to find the nearest edge
+      for (uint32_t i = 0; i < tile->header()->nodecount(); ++i) {
+        const NodeInfo* node = tile->node(i);
+        for (uint32_t j = 0; j < node->edge_count(); ++j) {
+          const DirectedEdge* directededge = tile->directededge(node->edge_index() + j);
+
+          // todo: this filter is in place in the bikesharing correlation; i don't see why we
+          // need it
+          // auto found = VALID_EDGE_USES.count(directededge->use());
+          // if (!found) {
+          //   continue;
+          // }
+
+          // skip shortcuts and the connections of parking spaces imported before this one
+          if ((!(directededge->forwardaccess() & policy::kModeMask)) ||
+              directededge->is_shortcut() || directededge->bss_connection()) {
+            continue;
+          }
 
-        auto levels = ei.levels().first;
-        if (level != parking_spaces::kInvalidLevel) {
-          if (levels.size() == 1) {
-            auto first_level = levels.at(0);
-            if (first_level.first == first_level.second && first_level.first == level) {
-              //
-            } else { // only one level but it's either a range or it does not match
+          auto ei = tile->edgeinfo(directededge);
+
+          auto levels = ei.levels().first;
+          if (level != parking_spaces::kInvalidLevel) {
+            if (levels.size() == 1) {
+              auto first_level = levels.at(0);
+              if (first_level.first == first_level.second && first_level.first == level) {
+                //
+              } else { // only one level but it's either a range or it does not match
+                continue;
+              }
+            } else { // valid level but the edge either has multiple or no levels
               continue;
             }
-          } else { // valid level but the edge either has multiple or no levels
-            continue;
-          }
-        } else {
-          if (levels.size() != 0) {
-            continue; // no level on the parking node, but the edge has a level, so skip
+          } else {
+            if (levels.size() != 0) {
+              continue; // no level on the parking node, but the edge has a level, so skip
+            }
           }
-        }
-
-        std::vector<PointLL> this_shape = edgeinfo.shape();
-        if (!directededge->forward()) {
-          std::reverse(this_shape.begin(), this_shape.end());
-        }
-        auto this_closest = bss_ll.Project(this_shape);
 
-        for (const auto access_mask : kAccessMasks) {
-          if (!(access_mask & kParkingAccessMask)) {
+          this_shape.clear();
+          for (auto decoder = ei.lazy_shape(); !decoder.empty();) {
+            this_shape.push_back(decoder.pop());
+          }
+          if (!directededge->forward()) {
+            std::reverse(this_shape.begin(), this_shape.end());
+          }
+          auto this_closest = bss_ll.Project(this_shape);
+          if (std::get<1>(this_closest) > radius) {
             continue;
           }
-          auto access_index = std::countr_zero(access_mask);
-          if ((directededge->forwardaccess() & access_mask) &&
-              std::get<1>(this_closest) < min_distances[access_index] - distanceEpsilon) {
-            min_distances[access_index] = std::get<1>(this_closest);
-            auto& proj = best_projections[access_index];
-            proj.directededge = directededge;
-            proj.shape = this_shape;
-            proj.closest = this_closest;
-            proj.startnode = i;
+
+          for (size_t access_index = 0; access_index < policy::kModes.size(); ++access_index) {
+            if ((directededge->forwardaccess() & policy::kModes[access_index]) &&
+                std::get<1>(this_closest) < min_distances[access_index] - distanceEpsilon) {
+              min_distances[access_index] = std::get<1>(this_closest);
+              auto& proj = best_projections[access_index];
+              proj.directededge = directededge;
+              proj.tile = tile;
+              proj.edge_id = GraphId(tile_id.tileid(), tile_id.level(), node->edge_index() + j);
+              proj.shape = this_shape;
+              proj.closest = this_closest;
+              proj.startnode = GraphId(tile_id.tileid(), tile_id.level(), i);
+            }
           }
         }
       }
     }
-    bool projection_failed = false;
-    for (const auto access_mask : kAccessMasks) {
-      if (!(access_mask & kParkingAccessMask)) {
-        continue;
-      }
 
-      auto& proj = best_projections[std::countr_zero(access_mask)];
-      if (proj.startnode == static_cast<uint32_t>(-1)) {
-        LOG_ERROR("Unable to find edge to project the BSS for access {}, osm id {}", access_mask,
-                  bss.node.osmid_);
+    bool projection_failed = false;
+    for (size_t access_index = 0; access_index < policy::kModes.size(); ++access_index) {
+      auto& proj = best_projections[access_index];
+      if (!proj.startnode.Is_Valid()) {
+        LOG_WARN("No edge within {}m to project the parking space for access {}, osm id {}",
+                 radius, policy::kModes[access_index], bss.node.osmid_);
         projection_failed = true;
         break;
       }
     }
 
     if (projection_failed) {
+      result.failed.push_back(bss);
       continue;
     }
 
     // multiple access modes can share the same edge, so make sure we only add them once
-    std::unordered_set<uint32_t> seen_edges;
+    std::pmr::unordered_map<uint64_t, size_t> seen_edges(arena);
 
     added_connections_per_bss.push_back(0);
     auto& added_count = added_connections_per_bss.back();
-    for (const auto access_mask : kAccessMasks) {
-      if (!(access_mask & kParkingAccessMask)) {
+    for (size_t access_index = 0; access_index < policy::kModes.size(); ++access_index) {
+      const auto access_mask = policy::kModes[access_index];
+      auto& proj = best_projections[access_index];
+
+      // edge info offsets are only unique within a tile
+      uint64_t edge_key = (static_cast<uint64_t>(proj.edge_id.tileid()) << 32) |
+                          proj.directededge->edgeinfo_offset();
+      auto seen = seen_edges.emplace(edge_key, res.size());
+      if (!seen.second) {
+        res[seen.first->second].modes |= access_mask;
+        res[seen.first->second + 1].modes |= access_mask;
         continue;
       }
 
-      auto& proj = best_projections[std::countr_zero(access_mask)];
-      if (!seen_edges.insert(proj.directededge->edgeinfo_offset()).second) {
-        continue;
+      auto edgeinfo = proj.tile->edgeinfo(proj.directededge);
+      // Store the information of the edge start <-> bss for pedestrian
+      auto start = parking_connection(bss.node, bss_ll, proj.startnode, edgeinfo,
+                                      // In order to simplify the problem, we ALWAYS consider that
+                                      // the outbound edge of start node is forward
+                                      true, proj);
+
+      start.osm_type = bss.type;
+      start.level = bss.level;
+      start.level_precision = bss.level_precision;
+      start.modes = access_mask;
+      start.forwardaccess = start.reverseaccess = policy::kAccess;
+      // Store the information of the edge end <-> bss for pedestrian
+      auto end =
+          parking_connection(bss.node, bss_ll, proj.directededge->endnode(), edgeinfo, false, proj);
+      end.osm_type = bss.type;
+      end.level = bss.level;
+      end.level_precision = bss.level_precision;
+      end.modes = access_mask;
+      end.forwardaccess = end.reverseaccess = policy::kAccess;
+
+      compute_and_fill_shape(proj, bss_ll, start, end);
+      res.push_back(std::move(start));
+      res.push_back(std::move(end));
+      added_count += 2;
+    }
+  }
+
+  return result;
+}
+
+/**
+ * @param arena where the temporaries of the projection are allocated
+ */
+projection_result
+project(parking_spaces::parking_type type,
+        const GraphTile& local_tile,
+        std::span<const parking_spaces::parking_space_node> osm_bss,
+        float radius,
+        const tile_getter_t& get_tile,
+        std::pmr::memory_resource* arena = std::pmr::get_default_resource()) {
+  switch (type) {
+    case parking_spaces::parking_type::bicycle:
+      return project<bicycle_parking>(local_tile, osm_bss, radius, get_tile, arena);
+    case parking_spaces::parking_type::motorcycle:
+      return project<motorcycle_parking>(local_tile, osm_bss, radius, get_tile, arena);
+    case parking_spaces::parking_type::car:
+    default:
+      return project<car_parking>(local_tile, osm_bss, radius, get_tile, arena);
+  }
+}
+
+/**
+ * Keeps the projections of the local tiles in a directory, so that an import after the graph was
+ * rebuilt only projects the tiles again whose parking spaces or surroundings changed, and takes
+ * all others straight to adding the parking nodes.
+ *
+ * A projection is found by a hash of the options, the tile's parking spaces and the content of
+ * all tiles within the search radius of them that the projection looks at: the edges with their
+ * ids, access, end nodes and edge info. Shortcuts and connection edges are left out, as the
+ * projection skips them, so a neighbouring tile hashes the same whether or not phase 1 already
+ * appended its parking nodes and their edges to it. The connection edges phase 2 inserts at the
+ * way nodes do move the ids of the edges after them, which the projection refers to, so tiles that
+ * still hold an earlier import hash differently than after stripping it (see --reimport).
+ * Entries are never removed, clear the directory to drop them.
+ */
+class projection_cache {
+public:
+  projection_cache(const std::string& dir, const correlation_options& opts)
+      : dir_(dir), radius_(opts.search_radius) {
+    std::filesystem::create_directories(dir_);
+    options_.mix(kVersion);
+    options_.mix(opts);
+  }
+
+  /**
+   * @return the key of the projection of the parking spaces in the local tile
+   */
+  uint64_t key(const GraphTile& local_tile,
+               std::span<const parking_spaces::parking_space_node> spaces,
+               const tile_getter_t& get_tile) {
+    auto hash = options_;
+    hash.mix(local_tile.id().value);
+    std::set<GraphId> nearby;
+    for (const auto& space : spaces) {
+      hash.mix(space);
+      for (const auto& [_, tile_id] :
+           tiles_within(space.node.latlng(), radius_, std::pmr::get_default_resource())) {
+        nearby.insert(tile_id);
+      }
+    }
+    for (const auto& tile_id : nearby) {
+      hash.mix(tile_id.value);
+      hash.mix(content(tile_id == local_tile.id() ? &local_tile : nullptr, tile_id, get_tile));
+    }
+    return hash.value();
+  }
+
+  /**
+   * @return the cached projection, nothing if there is none or it cannot be read
+   */
+  std::optional<projection_result> load(uint64_t key) {
+    const auto path = file(key);
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      ++misses_;
+      return std::nullopt;
+    }
+    const std::string bytes(std::istreambuf_iterator<char>(in), {});
+
+    try {
+      const char* pos = bytes.data();
+      const char* end = pos + bytes.size();
+      projection_result projection;
+      projection.counts.resize(read_varint(pos, end));
+      for (auto& count : projection.counts) {
+        count = read_varint(pos, end);
+      }
+      projection.connections.resize(read_varint(pos, end));
+      for (auto& conn : projection.connections) {
+        conn = decode_connection(pos, end);
+        read_raw(pos, end, conn.osm_node);
+        double projected[2];
+        read_raw(pos, end, projected);
+        conn.projected_ll = PointLL(projected[0], projected[1]);
+        conn.modes = read_varint(pos, end);
+        read_raw(pos, end, conn.level_precision);
+      }
+      projection.failed.resize(read_varint(pos, end));
+      for (auto& space : projection.failed) {
+        read_raw(pos, end, space);
+      }
+      if (pos != end) {
+        throw std::runtime_error("Trailing bytes");
       }
+      ++hits_;
+      return projection;
+    } catch (const std::exception& e) {
+      LOG_WARN("Ignoring the unreadable projection cache file {}: {}", path.string(), e.what());
+      ++misses_;
+      return std::nullopt;
+    }
+  }
+
+  /**
+   * Stores the projection so that it is either complete or not there at all. Shards may store
+   * the same projection at the same time.
+   */
+  void store(uint64_t key, const projection_result& projection) const {
+    std::string bytes;
+    append_varint(bytes, projection.counts.size());
+    for (auto count : projection.counts) {
+      append_varint(bytes, count);
+    }
+    append_varint(bytes, projection.connections.size());
+    for (const auto& conn : projection.connections) {
+      encode_connection(conn, bytes);
+      append_raw(bytes, conn.osm_node);
+      const double projected[2] = {conn.projected_ll.lng(), conn.projected_ll.lat()};
+      append_raw(bytes, projected);
+      append_varint(bytes, conn.modes);
+      append_raw(bytes, conn.level_precision);
+    }
+    append_varint(bytes, projection.failed.size());
+    for (const auto& space : projection.failed) {
+      append_raw(bytes, space);
+    }
+
+    const auto path = file(key);
+    auto tmp = path;
+    tmp += std::format(".{}.{}.tmp", getpid(),
+                       std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+      std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+      out.write(bytes.data(), bytes.size());
+      if (!out.flush()) {
+        throw std::runtime_error("Failed to write projection cache file " + path.string());
+      }
+    }
+    std::filesystem::rename(tmp, path);
+  }
+
+  size_t hits() const {
+    return hits_;
+  }
+
+  size_t misses() const {
+    return misses_;
+  }
+
+private:
+  // changes whenever the stored projections would come out differently for the same key
+  static constexpr uint32_t kVersion = 1;
+
+  std::filesystem::path file(uint64_t key) const {
+    return std::filesystem::path(dir_) / std::format("{:016x}.bin", key);
+  }
+
+  /**
+   * @return the hash of what the projection reads from a tile, computed once per tile and run
+   */
+  uint64_t content(const GraphTile* tile, const GraphId& tile_id, const tile_getter_t& get_tile) {
+    {
+      std::lock_guard<std::mutex> l(lock_);
+      if (auto found = contents_.find(tile_id); found != contents_.end()) {
+        return found->second;
+      }
+    }
+
+    graph_tile_ptr held;
+    if (!tile) {
+      held = get_tile(tile_id);
+      tile = held.get();
+    }
+    fnv1a hash;
+    hash.mix(tile != nullptr);
+    for (uint32_t i = 0; tile && i < tile->header()->nodecount(); ++i) {
+      const NodeInfo* node = tile->node(i);
+      for (uint32_t j = 0; j < node->edge_count(); ++j) {
+        const DirectedEdge* edge = tile->directededge(node->edge_index() + j);
+        if (edge->is_shortcut() || edge->bss_connection()) {
+          continue;
+        }
+        hash.mix(i);
+        // the candidate edges of the projection are kept by id
+        hash.mix(node->edge_index() + j);
+        hash.mix(edge->forwardaccess());
+        hash.mix(edge->forward());
+        hash.mix(edge->endnode().value);
+        hash.mix(edge->speed());
+        hash.mix(edge->surface());
+
+        auto ei = tile->edgeinfo(edge);
+        hash.mix(ei.wayid());
+        for (const auto& [from, to] : ei.levels().first) {
+          hash.mix(from);
+          hash.mix(to);
+        }
+        auto mix_strings = [&hash](const std::vector<std::string>& strings) {
+          hash.mix(strings.size());
+          for (const auto& string : strings) {
+            hash.mix(std::string_view(string));
+          }
+        };
+        mix_strings(ei.GetNames());
+        mix_strings(ei.GetTaggedValues());
+        mix_strings(ei.GetLinguisticTaggedValues());
+        for (auto decoder = ei.lazy_shape(); !decoder.empty();) {
+          auto ll = decoder.pop();
+          hash.mix(ll.lng());
+          hash.mix(ll.lat());
+        }
+      }
+    }
+
+    std::lock_guard<std::mutex> l(lock_);
+    contents_.emplace(tile_id, hash.value());
+    return hash.value();
+  }
+
+  std::string dir_;
+  float radius_;
+  fnv1a options_;
+
+  std::mutex lock_;
+  std::unordered_map<GraphId, uint64_t> contents_;
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
+};
+
+std::string format_id(const GraphId& id) {
+  return std::format("\"{}/{}/{}\"", id.level(), id.tileid(), id.id());
+}
+
+std::string format_modes(uint16_t modes) {
+  std::string names;
+  for (size_t i = 0; i < kAccessMasks.size(); ++i) {
+    if (modes & kAccessMasks[i]) {
+      names += std::format("{}\"{}\"", names.empty() ? "" : ",", kAccessNames[i]);
+    }
+  }
+  return "[" + names + "]";
+}
+
+std::string format_feature(const std::string& geometry, const std::string& properties) {
+  return std::format(R"({{"type":"Feature","geometry":{},"properties":{{{}}}}})", geometry,
+                     properties);
+}
+
+std::string format_point(const PointLL& ll) {
+  return std::format(R"({{"type":"Point","coordinates":[{:.7f},{:.7f}]}})", ll.lng(), ll.lat());
+}
+
+std::string format_line(const std::vector<PointLL>& shape) {
+  std::string coordinates;
+  for (const auto& ll : shape) {
+    coordinates += std::format("{}[{:.7f},{:.7f}]", coordinates.empty() ? "" : ",", ll.lng(),
+                               ll.lat());
+  }
+  return std::format(R"({{"type":"LineString","coordinates":[{}]}})", coordinates);
+}
+
+std::string format_parking(const parking_spaces::parking_space_node& bss, bool failed) {
+  auto level = bss.level == parking_spaces::kInvalidLevel ? std::string("null")
+                                                            : std::format("{}", bss.level);
+  return format_feature(format_point(bss.node.latlng()),
+                        std::format(R"("kind":"parking","osm_id":{},"osm_type":"{}",)"
+                                    R"("level":{},"failed":{})",
+                                    bss.node.osmid_,
+                                    bss.type == parking_spaces::osm_type::way ? "way" : "node",
+                                    level, failed));
+}
+
+/**
+ * Writes the projection results as a GeoJSON feature collection, so that the projection can be
+ * inspected without touching the tiles. Can be shared between threads.
+ */
+class geojson_writer {
+public:
+  explicit geojson_writer(const std::string& path) : out_(path, std::ios::trunc) {
+    if (!out_) {
+      throw std::runtime_error("Cannot open " + path + " for writing");
+    }
+    out_ << R"({"type":"FeatureCollection","features":[)";
+  }
+
+  ~geojson_writer() {
+    out_ << "]}\n";
+  }
 
-      auto edgeinfo = local_tile.edgeinfo(proj.directededge);
-      // Store the information of the edge start <-> bss for pedestrian
-      auto start =
-          parking_connection(bss.node, bss_ll,
-                             GraphId(local_tile.id().tileid(), local_level, proj.startnode), edgeinfo,
-                             // In order to simplify the problem, we ALWAYS consider that the
-                             // outbound edge of start node is forward
-                             true, proj);
+  void write(const projection_result& result) {
+    std::vector<std::string> features;
+    for (const auto& bss : result.failed) {
+      features.push_back(format_parking(bss, true));
+    }
 
-      start.level = bss.level;
-      start.level_precision = bss.level_precision;
-      // Store the information of the edge end <-> bss for pedestrian
-      auto end =
-          parking_connection(bss.node, bss_ll, proj.directededge->endnode(), edgeinfo, false, proj);
-      end.level = bss.level;
-      end.level_precision = bss.level_precision;
+    auto it = result.connections.begin();
+    for (size_t count : result.counts) {
+      parking_spaces::parking_space_node bss{};
+      bss.node = it->osm_node;
+      bss.level = it->level;
+      features.push_back(format_parking(bss, false));
+
+      // connections come in pairs of (start node -> parking, parking -> end node) per candidate
+      for (size_t j = 0; j < count; j += 2) {
+        const auto& start = *(it + j);
+        const auto& end = *(it + j + 1);
+        auto properties =
+            std::format(R"("kind":"projection","osm_id":{},"edge_id":{},"modes":{},)",
+                        start.osm_node.osmid_, format_id(start.candidate_edge),
+                        format_modes(start.modes)) +
+            std::format(R"("distance":{:.2f})", start.bss_ll.Distance(start.projected_ll));
+        features.push_back(format_feature(format_point(start.projected_ll), properties));
+        for (const auto* conn : {&start, &end}) {
+          features.push_back(format_feature(
+              format_line(conn->shape),
+              std::format(R"("kind":"connection","osm_id":{},"way_node_id":{},"modes":{})",
+                          conn->osm_node.osmid_, format_id(conn->way_node_id),
+                          format_modes(conn->modes))));
+        }
+      }
+      std::advance(it, count);
+    }
 
-      compute_and_fill_shape(proj, bss_ll, start, end);
-      res.push_back(std::move(start));
-      res.push_back(std::move(end));
-      added_count += 2;
+    std::lock_guard<std::mutex> l(lock_);
+    for (const auto& feature : features) {
+      out_ << (first_ ? "" : ",") << feature;
+      first_ = false;
     }
   }
 
-  return std::make_pair(res, added_connections_per_bss);
-}
+private:
+  std::mutex lock_;
+  std::ofstream out_;
+  bool first_ = true;
+};
 
 void add_nodes_and_edges(GraphTileBuilder& tilebuilder_local,
                          const GraphTile& tile,
-                         std::mutex& lock,
                          std::vector<parking_connection>& new_connections,
                          std::vector<size_t>& new_connection_counts) {
   auto local_level = TileHierarchy::levels().back().level;
-  auto scoped_finally = make_finally([&tilebuilder_local, &tile, &lock]() {
-    LOG_INFO("Storing local tile data with bss nodes, tile id: " +
-             std::to_string(tile.id().tileid()));
-    UNUSED(tile);
-    std::lock_guard<std::mutex> l(lock);
-    tilebuilder_local.StoreTileData();
-  });
 
   auto it = new_connections.begin();
   for (size_t i = 0; it != new_connections.end() && i < new_connection_counts.size();
@@ -381,7 +1724,7 @@ void add_nodes_and_edges(GraphTileBuilder& tilebuilder_local,
 
     NodeInfo new_bss_node{tile.header()->base_ll(),
                           it->bss_ll,
-                          kParkingAccessMask,
+                          static_cast<uint16_t>(it->forwardaccess),
                           NodeType::kParking,
                           false,
                           true,
@@ -424,7 +1767,7 @@ void add_nodes_and_edges(GraphTileBuilder& tilebuilder_local,
 
       bool added{false};
       auto directededge =
-          make_directed_edge(bss_to_waynode.way_node_id, bss_to_waynode.shape, bss_to_waynode,
+          make_directed_edge(bss_to_waynode.way_node_id, bss_to_waynode,
                              !bss_to_waynode.is_forward_from_waynode, 0);
 
       uint32_t edge_info_offset =
@@ -436,56 +1779,218 @@ void add_nodes_and_edges(GraphTileBuilder& tilebuilder_local,
 
       directededge.set_edgeinfo_offset(edge_info_offset);
       tilebuilder_local.directededges().emplace_back(std::move(directededge));
+
+      // the opposing edge can only point to this edge info from within the same tile
+      if (bss_to_waynode.way_node_id.Tile_Base() == tile.header()->graphid()) {
+        bss_to_waynode.edgeinfo_offset = edge_info_offset;
+      }
     }
   }
 }
 
-void project_and_add_parking_nodes(const boost::property_tree::ptree& pt,
-                                   std::mutex& lock,
-                                   bss_by_tile_t::const_iterator tile_start,
-                                   bss_by_tile_t::const_iterator tile_end,
-                                   std::vector<parking_connection>& all) {
+/**
+ * Records the parking nodes added by add_nodes_and_edges in the parking index
+ */
+void add_to_index(parking_spaces::parking_index_builder& index,
+                  const std::vector<parking_connection>& connections) {
+  for (auto it = connections.begin(); it != connections.end();) {
+    auto end = std::find_if(it, connections.end(), [&it](const parking_connection& conn) {
+      return conn.bss_node_id != it->bss_node_id;
+    });
+
+    std::vector<GraphId> way_nodes;
+    for (auto conn = it; conn != end; ++conn) {
+      way_nodes.push_back(conn->way_node_id);
+    }
+    index.add({it->bss_node_id.value, it->osm_node.osmid_, it->bss_ll.lng(), it->bss_ll.lat(),
+               it->level, 0, 0, static_cast<uint32_t>(it->osm_type)},
+              way_nodes);
+    it = end;
+  }
+}
 
-  GraphReader reader_local_level(pt);
-  for (; tile_start != tile_end; ++tile_start) {
+void project_and_add_parking_nodes(parking_spaces::tile_cache& cache,
+                                   const correlation_options& opts,
+                                   parking_spaces::tile_extract& extract,
+                                   parking_spaces::tile_journal* journal,
+                                   parking_spaces::tile_writer& writer,
+                                   geojson_writer* geojson,
+                                   connection_spill& spill,
+                                   parking_spaces::parking_index_builder& index,
+                                   const shard_plan* plan,
+                                   projection_pool& pool,
+                                   projection_cache* projections,
+                                   parking_spaces::correlation_result& result,
+                                   const bss_by_tile_t& bss_by_tile,
+                                   parking_spaces::tile_schedule& schedule,
+                                   size_t worker) {
+
+  // the tiles of the neighbouring shards are only read, they are written by their owner
+  parking_spaces::tile_prefetcher prefetcher(cache, extract, journal, schedule.source(worker),
+                                             opts.prefetch_tiles,
+                                             [&opts, plan](const GraphId& tile_id) {
+                                               return !opts.dry_run &&
+                                                      (!plan || plan->owns(tile_id));
+                                             });
+
+  // the projection skips the parking nodes and connection edges the writer may be adding to the
+  // neighbouring tiles, so it does not matter whether they are cached before or after that
+  auto get_tile = [&cache](const GraphId& tile_id) { return cache.get(tile_id); };
+
+  // the temporaries of each projection go to an arena, which is released before the next
+  tile_arena arena;
+  auto project_chunk = [&opts, &get_tile](const GraphTile& tile,
+                                          std::span<const parking_spaces::parking_space_node> spaces,
+                                          tile_arena& chunk_arena,
+                                          parking_spaces::tile_statistics& stats) {
+    chunk_arena.reset();
+    auto projection =
+        project(opts.type, tile, spaces, opts.search_radius, get_tile, chunk_arena.resource());
+    if (opts.shape_tolerance > 0.f || opts.truncate_shape) {
+      for (auto& conn : projection.connections) {
+        reduce_shape(conn, opts.shape_tolerance, opts.truncate_shape);
+      }
+    }
+    stats.arena_allocations = chunk_arena.allocations();
+    stats.heap_allocations = chunk_arena.heap_allocations();
+    return projection;
+  };
+
+  // dense tiles are cut into chunks for the pool, whose results are concatenated in order, so the
+  // tile comes out the same as if it had been projected in one go
+  auto project_chunks = [&](const GraphTile& tile,
+                            std::span<const parking_spaces::parking_space_node> spaces,
+                            parking_spaces::tile_statistics& stats) {
+    std::vector<std::span<const parking_spaces::parking_space_node>> chunks;
+    for (size_t i = 0; i < spaces.size(); i += opts.projection_chunk_size) {
+      chunks.push_back(spaces.subspan(i, std::min(opts.projection_chunk_size, spaces.size() - i)));
+    }
 
-    graph_tile_ptr local_tile = nullptr;
-    std::unique_ptr<GraphTileBuilder> tilebuilder_local = nullptr;
-    {
-      std::lock_guard<std::mutex> l(lock);
+    std::vector<projection_result> projections(chunks.size());
+    std::vector<parking_spaces::tile_statistics> chunk_stats(chunks.size());
+    std::vector<projection_pool::task_t> tasks;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      tasks.emplace_back([&, i](tile_arena& chunk_arena) {
+        projections[i] = project_chunk(tile, chunks[i], chunk_arena, chunk_stats[i]);
+      });
+    }
+    pool.run(tasks, arena);
+
+    projection_result projection;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      auto& part = projections[i];
+      projection.connections.insert(projection.connections.end(),
+                                    std::make_move_iterator(part.connections.begin()),
+                                    std::make_move_iterator(part.connections.end()));
+      projection.counts.insert(projection.counts.end(), part.counts.begin(), part.counts.end());
+      projection.failed.insert(projection.failed.end(), part.failed.begin(), part.failed.end());
+      stats.arena_allocations += chunk_stats[i].arena_allocations;
+      stats.heap_allocations += chunk_stats[i].heap_allocations;
+    }
+    return projection;
+  };
+
+  // tiles whose parking spaces and surroundings did not change since an earlier import take its
+  // projection from the cache
+  auto project_tile = [&](const GraphTile& tile, const auto& all_spaces,
+                          parking_spaces::tile_statistics& stats) {
+    std::span<const parking_spaces::parking_space_node> spaces(all_spaces);
+    std::optional<projection_result> projection;
+    uint64_t key = 0;
+    if (projections) {
+      key = projections->key(tile, spaces, get_tile);
+      projection = projections->load(key);
+      stats.cached = projection.has_value();
+    }
+    if (!projection) {
+      projection = project_chunks(tile, spaces, stats);
+      if (projections) {
+        projections->store(key, *projection);
+      }
+    }
+    size_t hidden = plan ? plan->drop_hidden(tile.id(), *projection) : 0;
+    return std::make_pair(std::move(*projection), hidden);
+  };
 
-      auto tile_id = tile_start->first;
-      local_tile = reader_local_level.GetGraphTile(tile_id);
-      tilebuilder_local =
-          std::make_unique<GraphTileBuilder>(reader_local_level.tile_dir(), tile_id, true);
+  while (true) {
+    // projections of dense tiles that wait for a worker go before our next tile
+    pool.help(arena);
+
+    auto loaded = prefetcher.next();
+    if (!loaded) {
+      break;
     }
+    auto& [tile_id, local_tile, tilebuilder_local] = *loaded;
+    const auto& spaces = bss_by_tile.at(tile_id);
 
-    auto new_connections = project(*local_tile, tile_start->second);
-    add_nodes_and_edges(*tilebuilder_local, *local_tile, lock, new_connections.first,
-                        new_connections.second);
-    {
-      std::lock_guard<std::mutex> l{lock};
-      std::move(new_connections.first.begin(), new_connections.first.end(), std::back_inserter(all));
+    if (plan && !plan->owns(tile_id)) {
+      // a tile of the neighbouring shard, which writes it: we only need the connections into our
+      // tiles, with the parking node ids its owner assigns when adding them to the pristine tile
+      if (opts.dry_run) {
+        continue;
+      }
+      parking_spaces::tile_statistics stats;
+      auto [projection, hidden] = project_tile(*local_tile, spaces, stats);
+      GraphTileBuilder builder(opts.pristine_dir, tile_id, true);
+      add_nodes_and_edges(builder, *local_tile, projection.connections, projection.counts);
+      spill.append(tile_id, plan->inbound(projection.connections));
+      continue;
+    }
+
+    parking_spaces::tile_statistics stats;
+    auto [new_connections, hidden] = project_tile(*local_tile, spaces, stats);
+    result.tiles.push_back({tile_id, spaces.size(),
+                            new_connections.counts.size(), new_connections.connections.size(),
+                            stats.arena_allocations, stats.heap_allocations, stats.cached});
+    for (const auto& space : new_connections.failed) {
+      result.failed.push_back(parking_spaces::parking_space_key(space));
+    }
+    result.dropped += hidden;
+    if (geojson) {
+      geojson->write(new_connections);
+    }
+    if (opts.dry_run) {
+      continue;
     }
+
+    add_nodes_and_edges(*tilebuilder_local, *local_tile, new_connections.connections,
+                        new_connections.counts);
+    add_to_index(index, new_connections.connections);
+    // the journal records the tile as done once it is stored, so its connections go first
+    spill.append(tile_id,
+                 plan ? plan->inbound(new_connections.connections) : new_connections.connections);
+    writer.push(std::move(tilebuilder_local));
   }
+
+  // dense tiles of other workers may still be waiting for help
+  pool.retire(arena);
+}
+
+/**
+ * The size of the edge info record written for a connection, i.e. what sharing it saves. The
+ * strings themselves are deduplicated in the text list either way.
+ */
+size_t edge_info_size(const parking_connection& conn) {
+  EdgeInfoBuilder builder;
+  builder.set_text_name_offset_list(std::vector<NameInfo>(
+      conn.names.size() + conn.tagged_values.size() + conn.linguistics.size()));
+  builder.set_encoded_shape(encode7(conn.shape));
+  return builder.SizeOf();
 }
 
 void create_edges(GraphTileBuilder& tilebuilder_local,
                   const GraphTile& tile,
-                  std::mutex& lock,
                   const std::vector<parking_connection>& bss_connections) {
   auto t1 = std::chrono::high_resolution_clock::now();
 
-  auto scoped_finally = make_finally([&tilebuilder_local, &tile, &lock, t1]() {
+  auto scoped_finally = make_finally([&tile, t1]() {
     auto t2 = std::chrono::high_resolution_clock::now();
     uint32_t secs = std::chrono::duration_cast<std::chrono::seconds>(t2 - t1).count();
 
     LOG_INFO("Tile id: " + std::to_string(tile.id().tileid()) + " It took " + std::to_string(secs) +
-             " seconds to create edges. Now storing local tile data with new edges");
+             " seconds to create edges");
     UNUSED(tile);
     UNUSED(secs);
-    std::lock_guard<std::mutex> l(lock);
-    tilebuilder_local.StoreTileData();
   });
 
   // Move existing nodes and directed edge builder vectors and clear the lists
@@ -513,6 +2018,7 @@ void create_edges(GraphTileBuilder& tilebuilder_local,
   // Iterate through the nodes - add back any stored edges and insert any
   // connections from a node to a transit stop. Update each nodes edge index.
   uint32_t added_edges = 0;
+  size_t shared_edges = 0, shared_bytes = 0;
 
   for (auto& nb : currentnodes) {
     size_t nodeid = tilebuilder_local.nodes().size();
@@ -566,14 +2072,23 @@ void create_edges(GraphTileBuilder& tilebuilder_local,
     while (lower != upper && lower != bss_connections.end()) {
       size_t local_idx = tilebuilder_local.directededges().size() - edge_index;
 
-      auto directededge = make_directed_edge(lower->bss_node_id, lower->shape, *lower,
+      auto directededge = make_directed_edge(lower->bss_node_id, *lower,
                                              lower->is_forward_from_waynode, local_idx);
-      bool added;
-      uint32_t edge_info_offset =
-          tilebuilder_local.AddEdgeInfo(tilebuilder_local.directededges().size(), lower->way_node_id,
-                                        lower->bss_node_id, lower->wayid, 0, 0, 0, lower->shape,
-                                        lower->names, lower->tagged_values, lower->linguistics, 0,
-                                        added);
+
+      // like regular opposing edges, share the edge info of the parking -> way node edge if it
+      // was written to this tile in phase 1
+      uint32_t edge_info_offset = lower->edgeinfo_offset;
+      if (edge_info_offset != kNoEdgeInfo) {
+        shared_edges++;
+        shared_bytes += edge_info_size(*lower);
+      } else {
+        bool added;
+        edge_info_offset =
+            tilebuilder_local.AddEdgeInfo(tilebuilder_local.directededges().size(),
+                                          lower->way_node_id, lower->bss_node_id, lower->wayid, 0,
+                                          0, 0, lower->shape, lower->names, lower->tagged_values,
+                                          lower->linguistics, 0, added);
+      }
 
       directededge.set_edgeinfo_offset(edge_info_offset);
 
@@ -589,29 +2104,217 @@ void create_edges(GraphTileBuilder& tilebuilder_local,
   }
 
   LOG_INFO(std::string("Added: ") + std::to_string(added_edges) + " edges from existing nodes");
+  LOG_INFO("Tile id: {} {} edges share the edge info of their opposing edge, saving {} bytes",
+           tile.id().tileid(), shared_edges, shared_bytes);
 }
 
 void create_edges_from_way_node(
-    const boost::property_tree::ptree& pt,
-    std::mutex& lock,
-    std::unordered_map<GraphId, std::vector<parking_connection>>::const_iterator tile_start,
-    std::unordered_map<GraphId, std::vector<parking_connection>>::const_iterator tile_end) {
+    parking_spaces::tile_cache& cache,
+    const correlation_options& opts,
+    parking_spaces::tile_extract& extract,
+    parking_spaces::tile_journal* journal,
+    parking_spaces::tile_writer& writer,
+    const connection_spill& spill,
+    parking_spaces::tile_schedule& schedule,
+    size_t worker) {
+
+  parking_spaces::tile_prefetcher prefetcher(cache, extract, journal, schedule.source(worker),
+                                             opts.prefetch_tiles,
+                                             [](const GraphId&) { return true; });
+
+  while (auto loaded = prefetcher.next()) {
+    auto& [tile_id, local_tile, tilebuilder_local] = *loaded;
+
+    // the search for the connections of each node relies on them being sorted, and sorting by
+    // the full key makes the edge order independent of the order the spill files were written in
+    auto connections = spill.read(tile_id);
+    boost::sort(connections);
+
+    create_edges(*tilebuilder_local, *local_tile, connections);
+    writer.push(std::move(tilebuilder_local));
+  }
+}
 
-  GraphReader reader_local_level(pt);
-  for (; tile_start != tile_end; ++tile_start) {
+/**
+ * @return the mjolnir config reading the tiles from pristine_dir
+ */
+boost::property_tree::ptree pristine_config(const boost::property_tree::ptree& pt,
+                                            const std::string& pristine_dir) {
+  auto mjolnir = pt.get_child("mjolnir");
+  mjolnir.put("tile_dir", pristine_dir);
+  mjolnir.erase("tile_extract");
+  return mjolnir;
+}
 
-    graph_tile_ptr local_tile = nullptr;
-    std::unique_ptr<GraphTileBuilder> tilebuilder_local = nullptr;
-    {
-      std::lock_guard<std::mutex> l(lock);
+/**
+ * Replaces the tile in tile_dir with its pristine version
+ */
+void copy_pristine(const std::string& pristine_dir,
+                   const std::string& tile_dir,
+                   const GraphId& tile_id) {
+  auto suffix = GraphTile::FileSuffix(tile_id.Tile_Base());
+  auto target = std::filesystem::path(tile_dir) / suffix;
+  std::filesystem::create_directories(target.parent_path());
+  std::filesystem::copy_file(std::filesystem::path(pristine_dir) / suffix, target,
+                             std::filesystem::copy_options::overwrite_existing);
+}
+
+/**
+ * Runs work for every tile on concurrency threads and rethrows the first error
+ */
+template <class work_t>
+void for_each_tile(const std::vector<GraphId>& tiles, size_t concurrency, work_t work) {
+  std::atomic<size_t> next{0};
+  std::vector<std::exception_ptr> errors(tiles.size());
+  std::vector<std::thread> threads(std::min(std::max<size_t>(concurrency, 1), tiles.size()));
+  for (auto& thread : threads) {
+    thread = std::thread([&]() {
+      for (size_t i = next++; i < tiles.size(); i = next++) {
+        try {
+          work(tiles[i]);
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+}
+
+/**
+ * @return whether the node is a parking node added by the import, recognisable by all its edges
+ *         being connection edges
+ */
+bool is_imported_parking(const GraphTile& tile, const NodeInfo& node) {
+  if (node.type() != NodeType::kParking || node.edge_count() == 0) {
+    return false;
+  }
+  for (uint32_t i = 0; i < node.edge_count(); ++i) {
+    if (!tile.directededge(node.edge_index() + i)->bss_connection()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @return whether the edge connects a way node to an imported parking node
+ */
+bool is_imported_connection(const DirectedEdge& edge, const std::unordered_set<GraphId>& parking) {
+  return edge.bss_connection() && parking.contains(edge.endnode());
+}
+
+/**
+ * Removes the imported parking nodes, their edges and the connection edges pointing to them from
+ * a tile in a single pass, the reverse of add_nodes_and_edges and create_edges.
+ *
+ * @return the number of removed edges
+ */
+size_t strip_tile(const std::string& tile_dir,
+                  const GraphId& tile_id,
+                  const std::unordered_set<GraphId>& parking) {
+  GraphTileBuilder tilebuilder_local(tile_dir, tile_id, true);
+
+  std::vector<NodeInfo> currentnodes(std::move(tilebuilder_local.nodes()));
+  tilebuilder_local.nodes().clear();
+
+  std::vector<DirectedEdge> currentedges(std::move(tilebuilder_local.directededges()));
+  tilebuilder_local.directededges().clear();
+
+  // the parking nodes were appended to the tile, so removing them keeps all other node ids
+  auto node_id = [&tile_id](size_t i) {
+    return GraphId(tile_id.tileid(), tile_id.level(), static_cast<uint32_t>(i));
+  };
+  size_t keptnodes = currentnodes.size();
+  while (keptnodes > 0 && parking.contains(node_id(keptnodes - 1))) {
+    --keptnodes;
+  }
+  for (size_t i = 0; i < keptnodes; ++i) {
+    if (parking.contains(node_id(i))) {
+      throw std::runtime_error(std::format("Tile {} has parking nodes before other nodes, it was "
+                                           "modified after the parking spaces were imported",
+                                           tile_id.tileid()));
+    }
+  }
+
+  // same as in create_edges, but moving the signs and restrictions back
+  uint32_t signidx = 0;
+  uint32_t nextsignidx = (tilebuilder_local.header()->signcount() > 0)
+                             ? tilebuilder_local.sign(0).index()
+                             : currentedges.size() + 1;
+  uint32_t signcount = tilebuilder_local.header()->signcount();
+
+  uint32_t residx = 0;
+  uint32_t nextresidx = (tilebuilder_local.header()->access_restriction_count() > 0)
+                            ? tilebuilder_local.accessrestriction(0).edgeindex()
+                            : currentedges.size() + 1;
+  uint32_t rescount = tilebuilder_local.header()->access_restriction_count();
+
+  uint32_t removed_edges = 0;
+  uint32_t max_kept_info = 0, min_removed_info = kNoEdgeInfo;
+  for (size_t n = 0; n < keptnodes; ++n) {
+    auto& nb = currentnodes[n];
+    size_t edge_index = tilebuilder_local.directededges().size();
+
+    for (uint32_t i = 0, idx = nb.edge_index(); i < nb.edge_count(); i++, idx++) {
+      if (is_imported_connection(currentedges[idx], parking)) {
+        min_removed_info = std::min(min_removed_info, currentedges[idx].edgeinfo_offset());
+        removed_edges++;
+        continue;
+      }
+      max_kept_info = std::max(max_kept_info, currentedges[idx].edgeinfo_offset());
+      tilebuilder_local.directededges().emplace_back(currentedges[idx]);
+
+      while (idx == nextsignidx && signidx < signcount) {
+        tilebuilder_local.sign_builder(signidx).set_index(idx - removed_edges);
+        signidx++;
+        nextsignidx = (signidx >= signcount) ? 0 : tilebuilder_local.sign(signidx).index();
+      }
+
+      while (idx == nextresidx && residx < rescount) {
+        tilebuilder_local.accessrestriction_builder(residx).set_edgeindex(idx - removed_edges);
+        residx++;
+        nextresidx =
+            (residx >= rescount) ? 0 : tilebuilder_local.accessrestriction(residx).edgeindex();
+      }
+    }
+
+    nb.set_edge_index(edge_index);
+    nb.set_edge_count(tilebuilder_local.directededges().size() - edge_index);
+    tilebuilder_local.nodes().emplace_back(std::move(nb));
+  }
 
-      auto tile_id = tile_start->first;
-      local_tile = reader_local_level.GetGraphTile(tile_id);
-      tilebuilder_local =
-          std::make_unique<GraphTileBuilder>(reader_local_level.tile_dir(), tile_id, true);
+  // the edges of the parking nodes come after all others
+  for (size_t n = keptnodes; n < currentnodes.size(); ++n) {
+    const auto& nb = currentnodes[n];
+    for (uint32_t i = 0, idx = nb.edge_index(); i < nb.edge_count(); i++, idx++) {
+      min_removed_info = std::min(min_removed_info, currentedges[idx].edgeinfo_offset());
     }
-    create_edges(*tilebuilder_local, *local_tile, lock, tile_start->second);
   }
+
+  // GraphTileBuilder keeps the edge infos of a tile in offset order, and only drops unused ones at
+  // the end of the list without moving the offsets of the others
+  if (min_removed_info != kNoEdgeInfo && min_removed_info < max_kept_info) {
+    throw std::runtime_error(std::format("Tile {} has edge infos added after the parking spaces "
+                                         "were imported, it cannot be stripped",
+                                         tile_id.tileid()));
+  }
+
+  size_t removed = currentedges.size() - tilebuilder_local.directededges().size();
+  tilebuilder_local.StoreTileData();
+
+  // the edge infos of the removed edges are still written at the end of the tile, reading it
+  // again leaves them out
+  GraphTileBuilder compacted(tile_dir, tile_id, true);
+  compacted.StoreTileData();
+  return removed;
 }
 
 } // namespace
@@ -622,12 +2325,10 @@ namespace parking_spaces {
 /* The import of bike share station(BSS) into the tiles is done in two steps with some hypothesis in
  * order to simply the problem.
  *
- * We assume that the BSS node and the startnode of projected edge(either the forward edge or its evil
- * twin reverse edge) are always in the same tile.
- *
- * We handle only two cases and we assume that there are very rare cases that the BSS node,
- * the startnode and the endnode of projected edge are in 3 different tiles, but it's common that the
- * projected edge crosses tiles.
+ * Candidate edges are searched within parking_spaces.search_radius of the BSS node, including the
+ * neighbouring tiles the radius reaches, so the BSS node, the startnode and the endnode of the
+ * projected edge can all be in different tiles. Nodes without a candidate within the radius are
+ * dropped.
  *
  * Case 1 (handled):
  *
@@ -649,7 +2350,7 @@ namespace parking_spaces {
  *           |     |
  *          Bss
  *
- * Case 3 (not handled, rare):
+ * Case 3 (handled):
  *
  *
  *                 |
@@ -678,110 +2379,483 @@ namespace parking_spaces {
  *
  *
  * */
-void correlate_parking_spaces(const boost::property_tree::ptree& pt,
-                              const std::string& parking_nodes_bin) {
+correlation_result correlate_parking_spaces(const boost::property_tree::ptree& pt,
+                                            std::span<const parking_space_node> bss_nodes) {
 
   LOG_INFO("Importing parking_spaces");
 
-  valhalla::midgard::sequence<parking_spaces::parking_space_node> bss_nodes{parking_nodes_bin, false};
-
+  correlation_result result;
   bss_by_tile_t bss_by_tile;
 
-  GraphReader reader(pt.get_child("mjolnir"));
+  // shards read the pristine tiles, as their neighbours write the tiles next to theirs
+  correlation_options opts(pt);
+  const auto mjolnir =
+      opts.shards > 1 ? pristine_config(pt, opts.pristine_dir) : pt.get_child("mjolnir");
+  if (opts.shards > 1 && !std::filesystem::exists(opts.pristine_dir)) {
+    throw std::runtime_error("Sharded imports read the tiles from " + opts.pristine_dir +
+                             ", copy mjolnir.tile_dir there before starting the shards");
+  }
+
+  // guards the reader of the tile cache, the tile files themselves are guarded by its file locks
+  std::mutex lock;
+
+  // every stage and thread reads the tiles through the same cache
+  parking_spaces::tile_cache cache(mjolnir, lock, opts.tile_cache_size);
   auto local_level = TileHierarchy::levels().back().level;
 
   // Group the nodes by their tiles. In the next step, we will work on each tile only once
   for (auto bss : bss_nodes) {
     PointLL latlng = bss.node.latlng();
     auto tile_id = TileHierarchy::GetGraphId({latlng.first, latlng.second}, local_level);
-    graph_tile_ptr local_tile = reader.GetGraphTile(tile_id);
-    if (!local_tile) {
+    if (!cache.get(tile_id)) {
       LOG_INFO("Cannot find node in tiles, latlng = {},{}", latlng.lat(), latlng.lng());
+      ++result.outside;
       continue;
     }
     bss_by_tile[tile_id].push_back(bss);
   }
 
+  std::unique_ptr<shard_plan> plan;
+  if (opts.shards > 1) {
+    plan = std::make_unique<shard_plan>(bss_by_tile, opts.shard, opts.shards);
+    std::erase_if(bss_by_tile, [&plan](const auto& tile) { return !plan->needs(tile.first); });
+  }
+
   size_t nb_threads =
       std::max(static_cast<uint32_t>(1),
                pt.get<uint32_t>("mjolnir.concurrency", std::thread::hardware_concurrency()));
   std::vector<std::shared_ptr<std::thread>> threads(nb_threads);
 
-  // An atomic object we can use to do the synchronization
-  std::mutex lock;
+  // Where the tile builders read from and store to
+  parking_spaces::tile_extract extract(pt);
+  if (plan && extract.enabled()) {
+    throw std::runtime_error("Sharded imports cannot write tile extracts");
+  }
+
+  // imports into the tile directory keep a journal to resume from. Extracts and shards never
+  // modify the tiles they read, so they can simply be run again
+  const auto tile_dir = pt.get<std::string>("mjolnir.tile_dir");
+  std::unique_ptr<parking_spaces::tile_journal> journal;
+  std::unordered_set<GraphId> resumed;
+  if (opts.journal && !opts.dry_run && !plan && !extract.enabled()) {
+    journal = std::make_unique<parking_spaces::tile_journal>(tile_dir, opts.journal_dir,
+                                                             import_fingerprint(bss_nodes, opts));
+    for (const auto& [tile_id, _] : bss_by_tile) {
+      if (journal->done(1, tile_id)) {
+        resumed.insert(tile_id);
+      }
+    }
+    std::erase_if(bss_by_tile, [&resumed](const auto& tile) { return resumed.contains(tile.first); });
+  }
+
+  std::unique_ptr<geojson_writer> geojson;
+  if (!opts.geojson.empty()) {
+    geojson = std::make_unique<geojson_writer>(opts.geojson);
+  }
 
   // Start the threads
   LOG_INFO("Adding " + std::to_string(bss_nodes.size()) + " bike share stations to " +
            std::to_string(bss_by_tile.size()) + " local graphs with " + std::to_string(nb_threads) +
            " thread(s)");
 
-  std::vector<parking_connection> all;
+  // a shard starts its tiles over from their pristine versions, so it can simply be run again
+  if (plan && !opts.dry_run) {
+    for (const auto& [tile_id, _] : bss_by_tile) {
+      if (plan->owns(tile_id)) {
+        copy_pristine(opts.pristine_dir, tile_dir, tile_id);
+      }
+    }
+  }
+
+  // phase 1 hands the connections to phase 2 through per-tile files, which a resumed import needs
+  // for the tiles finished before
+  connection_spill spill(journal ? journal->dir() + "/spill"
+                                 : tile_dir + std::string(kSpillDir) +
+                                       (plan ? "_" + std::to_string(opts.shard) : ""),
+                         journal != nullptr);
+  parking_spaces::parking_index_builder index;
+  // each worker reports into its own part, they are merged once all are done
+  std::vector<correlation_result> parts(threads.size());
+  projection_pool pool(threads.size());
+  std::unique_ptr<projection_cache> projections;
+  if (!opts.projection_cache.empty()) {
+    projections = std::make_unique<projection_cache>(opts.projection_cache, opts);
+  }
   {
-    size_t floor = bss_by_tile.size() / threads.size();
-    size_t at_ceiling = bss_by_tile.size() - (threads.size() * floor);
-    bss_by_tile_t::const_iterator tile_start, tile_end = bss_by_tile.begin();
+    // finished tiles are stored in the background while the workers move on
+    if (journal) {
+      journal->begin(1);
+    }
+    parking_spaces::tile_writer writer(cache, opts.write_queue_size, journal.get());
+
+    // the workers start on their own runs of neighbouring tiles and steal once they are done
+    std::vector<GraphId> tile_ids;
+    for (const auto& [tile_id, _] : bss_by_tile) {
+      tile_ids.push_back(tile_id);
+    }
+    parking_spaces::tile_schedule schedule(std::move(tile_ids), threads.size());
 
     for (size_t i = 0; i < threads.size(); ++i) {
-      // Figure out how many this thread will work on (either ceiling or floor)
-      size_t tile_count = (i < at_ceiling ? floor + 1 : floor);
-      // Where the range begins
-      tile_start = tile_end;
-      // Where the range ends
-      std::advance(tile_end, tile_count);
-      // Make the thread
-      threads[i] = std::make_shared<std::thread>(project_and_add_parking_nodes,
-                                                 std::cref(pt.get_child("mjolnir")), std::ref(lock),
-                                                 tile_start, tile_end, std::ref(all));
+      threads[i] = std::make_shared<std::thread>(project_and_add_parking_nodes, std::ref(cache),
+                                                 std::cref(opts), std::ref(extract), journal.get(),
+                                                 std::ref(writer), geojson.get(), std::ref(spill),
+                                                 std::ref(index), plan.get(), std::ref(pool),
+                                                 projections.get(), std::ref(parts[i]),
+                                                 std::cref(bss_by_tile), std::ref(schedule), i);
     }
 
     for (auto& thread : threads) {
       thread->join();
     }
+    writer.finish();
   }
 
-  // the collection is sorted so that the search will be much faster later.
-  boost::sort(all);
+  for (auto& part : parts) {
+    result.tiles.insert(result.tiles.end(), part.tiles.begin(), part.tiles.end());
+    result.failed.insert(result.failed.end(), part.failed.begin(), part.failed.end());
+    result.dropped += part.dropped;
+  }
+  std::sort(result.tiles.begin(), result.tiles.end(),
+            [](const tile_statistics& a, const tile_statistics& b) { return a.tile_id < b.tile_id; });
+  std::sort(result.failed.begin(), result.failed.end());
+
+  if (!resumed.empty()) {
+    // the parking nodes of the tiles an earlier run finished are only known from their spill files
+    auto connections = spill.read_from(resumed);
+    std::stable_sort(connections.begin(), connections.end(),
+                     [](const parking_connection& a, const parking_connection& b) {
+                       return a.bss_node_id < b.bss_node_id;
+                     });
+    add_to_index(index, connections);
+    LOG_INFO("Skipped {} tiles an earlier run added parking nodes to", resumed.size());
+  }
 
-  // outboud edges from way node are grouped by tiles.
-  std::unordered_map<GraphId, std::vector<parking_connection>> map;
-  if (!all.empty()) {
-    auto chunk_start = all.begin();
-    do {
-      auto tileid = chunk_start->way_node_id.tileid();
-      auto chunk_end = std::stable_partition(chunk_start, all.end(), [tileid](const auto& conn) {
-        return tileid == conn.way_node_id.tileid();
-      });
+  if (projections) {
+    LOG_INFO("Took {} tile projections from the projection cache, projected {} tiles",
+             projections->hits(), projections->misses());
+  }
+
+  size_t arena_allocations = 0, heap_allocations = 0;
+  for (const auto& tile : result.tiles) {
+    arena_allocations += tile.arena_allocations;
+    heap_allocations += tile.heap_allocations;
+  }
+  LOG_INFO("The projection made {} allocations from the tile arenas, which took {} blocks from "
+           "the heap",
+           arena_allocations, heap_allocations);
+
+  if (!result.failed.empty()) {
+    LOG_WARN("Dropped {} parking spaces without a candidate edge within {}m", result.failed.size(),
+             opts.search_radius);
+  }
+  if (result.dropped > 0) {
+    LOG_WARN("Dropped {} connections to tiles of other shards that are not next to this one",
+             result.dropped);
+  }
 
-      std::move(chunk_start, chunk_end, std::back_inserter(map[{tileid, local_level, 0}]));
+  if (opts.dry_run) {
+    LOG_INFO("Dry run, leaving the tiles untouched");
+    return result;
+  }
 
-      chunk_start = chunk_end;
+  // phase 1 rewrote the parking tiles, unless they are read from the pristine tiles or an extract
+  if (!plan && !extract.enabled()) {
+    cache.clear();
+  }
 
-    } while (chunk_start != all.end());
+  // outbound edges from way nodes are grouped by tiles.
+  auto way_node_tiles = spill.tiles();
+  if (journal) {
+    journal->begin(2);
+    std::erase_if(way_node_tiles,
+                  [&journal](const GraphId& tile_id) { return journal->done(2, tile_id); });
+  }
+  if (plan) {
+    for (const auto& tile_id : way_node_tiles) {
+      if (!bss_by_tile.contains(tile_id)) {
+        copy_pristine(opts.pristine_dir, tile_dir, tile_id);
+      }
+    }
   }
 
   {
-    size_t floor = map.size() / threads.size();
-    size_t at_ceiling = map.size() - (threads.size() * floor);
-    std::unordered_map<GraphId, std::vector<parking_connection>>::const_iterator tile_start,
-        tile_end = map.begin();
+    parking_spaces::tile_writer writer(cache, opts.write_queue_size, journal.get());
+
+    parking_spaces::tile_schedule schedule(std::move(way_node_tiles), threads.size());
 
     for (size_t i = 0; i < threads.size(); ++i) {
-      // Figure out how many this thread will work on (either ceiling or floor)
-      size_t tile_count = (i < at_ceiling ? floor + 1 : floor);
-      // Where the range begins
-      tile_start = tile_end;
-      // Where the range ends
-      std::advance(tile_end, tile_count);
-      // Make the thread
-      threads[i] = std::make_shared<std::thread>(create_edges_from_way_node,
-                                                 std::cref(pt.get_child("mjolnir")), std::ref(lock),
-                                                 tile_start, tile_end);
+      threads[i] = std::make_shared<std::thread>(create_edges_from_way_node, std::ref(cache),
+                                                 std::cref(opts), std::ref(extract), journal.get(),
+                                                 std::ref(writer), std::cref(spill),
+                                                 std::ref(schedule), i);
     }
 
     for (auto& thread : threads) {
       thread->join();
     }
+    writer.finish();
+  }
+
+  extract.finish();
+  index.write(opts.index);
+  if (journal) {
+    journal->finish();
+  }
+
+  auto stats = cache.stats();
+  LOG_INFO("Tile cache: {} hits, {} misses, {} evictions", stats.hits, stats.misses,
+           stats.evictions);
+  return result;
+}
+
+correlation_result correlate_parking_spaces(const boost::property_tree::ptree& pt,
+                                            const std::string& parking_nodes_bin) {
+  // the parse output is mapped rather than copied
+  auto count = std::filesystem::file_size(parking_nodes_bin) / sizeof(parking_space_node);
+  mem_map<parking_space_node> bss_nodes;
+  if (count > 0) {
+    bss_nodes.map(parking_nodes_bin, count, POSIX_MADV_SEQUENTIAL, true);
+  }
+  return correlate_parking_spaces(pt, std::span<const parking_space_node>(bss_nodes.get(), count));
+}
+
+size_t remove_parking_spaces(const boost::property_tree::ptree& pt) {
+  const auto tile_dir = pt.get<std::string>("mjolnir.tile_dir");
+  const auto concurrency =
+      pt.get<size_t>("mjolnir.concurrency", std::thread::hardware_concurrency());
+  if (pt.get_optional<std::string>("mjolnir.tile_extract")) {
+    throw std::runtime_error("Parking spaces can only be removed from mjolnir.tile_dir");
+  }
+  // the journal of an import that died would resume it on top of the stripped tiles
+  std::filesystem::remove_all(correlation_options(pt).journal_dir);
+
+  std::vector<GraphId> tiles;
+  {
+    GraphReader reader(pt.get_child("mjolnir"));
+    auto tile_set = reader.GetTileSet(TileHierarchy::levels().back().level);
+    tiles.assign(tile_set.begin(), tile_set.end());
+  }
+
+  // first find all imported parking nodes, as connection edges can point to other tiles
+  std::mutex lock;
+  std::unordered_set<GraphId> parking;
+  for_each_tile(tiles, concurrency, [&](const GraphId& tile_id) {
+    auto tile = GraphTile::Create(tile_dir, tile_id);
+    std::vector<GraphId> found;
+    for (uint32_t i = 0; tile && i < tile->header()->nodecount(); ++i) {
+      if (is_imported_parking(*tile, *tile->node(i))) {
+        found.emplace_back(tile_id.tileid(), tile_id.level(), i);
+      }
+    }
+    std::lock_guard<std::mutex> l(lock);
+    parking.insert(found.begin(), found.end());
+  });
+
+  if (parking.empty()) {
+    LOG_INFO("No imported parking spaces found in {}", tile_dir);
+    return 0;
+  }
+
+  std::atomic<size_t> stripped_tiles{0}, removed_edges{0};
+  for_each_tile(tiles, concurrency, [&](const GraphId& tile_id) {
+    auto tile = GraphTile::Create(tile_dir, tile_id);
+    if (!tile) {
+      return;
+    }
+    // parking nodes are the last nodes of their tile
+    auto nodecount = tile->header()->nodecount();
+    bool touched =
+        nodecount > 0 && parking.contains(GraphId(tile_id.tileid(), tile_id.level(), nodecount - 1));
+    for (uint32_t i = 0; !touched && i < tile->header()->directededgecount(); ++i) {
+      touched = is_imported_connection(*tile->directededge(i), parking);
+    }
+    tile.reset();
+    if (!touched) {
+      return;
+    }
+
+    removed_edges += strip_tile(tile_dir, tile_id, parking);
+    ++stripped_tiles;
+  });
+
+  LOG_INFO("Removed {} parking nodes and {} connection edges from {} tiles", parking.size(),
+           removed_edges.load(), stripped_tiles.load());
+
+  // the parking index describes the removed nodes
+  std::filesystem::remove(correlation_options(pt).index);
+  return parking.size();
+}
+
+struct tile_patcher::impl {
+  impl(const boost::property_tree::ptree& pt, const std::string& pristine_dir)
+      : opts(pt), live_dir(pt.get<std::string>("mjolnir.tile_dir")), pristine_dir(pristine_dir),
+        tiles(pristine_config(pt, pristine_dir), lock, opts.tile_cache_size) {
+  }
+
+  GraphId tile_of(const parking_space_node& space) {
+    auto latlng = space.node.latlng();
+    return TileHierarchy::GetGraphId({latlng.first, latlng.second},
+                                     TileHierarchy::levels().back().level);
+  }
+
+  /**
+   * Projects the parking spaces of the changed tiles again and rebuilds every tile that holds
+   * parking nodes or connection edges of them, before or after the change.
+   */
+  size_t rebuild(const std::set<GraphId>& changed, patch_result& result) {
+    auto get_tile = [this](const GraphId& tile_id) { return tiles.get(tile_id); };
+
+    std::set<GraphId> rebuilt(changed.begin(), changed.end());
+    for (const auto& tile_id : changed) {
+      for (const auto& conn : phase1[tile_id]) {
+        rebuilt.insert(conn.way_node_id.Tile_Base());
+      }
+      for (const auto& way_tile : feeds[tile_id]) {
+        feeders[way_tile].erase(tile_id);
+      }
+      feeds.erase(tile_id);
+      projections.erase(tile_id);
+      phase1.erase(tile_id);
+
+      auto found = spaces_by_tile.find(tile_id);
+      if (found == spaces_by_tile.end() || found->second.empty()) {
+        continue;
+      }
+
+      std::vector<parking_space_node> tile_spaces;
+      for (auto key : found->second) {
+        tile_spaces.push_back(spaces.at(key));
+      }
+      auto projection =
+          project(opts.type, *tiles.get(tile_id), tile_spaces, opts.search_radius, get_tile);
+      for (const auto& space : projection.failed) {
+        result.failed.push_back(parking_space_key(space));
+      }
+      for (auto& conn : projection.connections) {
+        reduce_shape(conn, opts.shape_tolerance, opts.truncate_shape);
+        rebuilt.insert(conn.way_node_id.Tile_Base());
+        feeds[tile_id].insert(conn.way_node_id.Tile_Base());
+        feeders[conn.way_node_id.Tile_Base()].insert(tile_id);
+      }
+      projections[tile_id] = std::move(projection);
+    }
+
+    // the parking nodes of all rebuilt tiles are added again, which gives unchanged tiles the same
+    // node ids as before so the connection edges pointing to them stay valid
+    for (const auto& tile_id : rebuilt) {
+      copy_pristine(pristine_dir, live_dir, tile_id);
+      auto projection = projections.find(tile_id);
+      if (projection == projections.end()) {
+        continue;
+      }
+
+      auto connections = projection->second.connections;
+      auto counts = projection->second.counts;
+      GraphTileBuilder builder(live_dir, tile_id, true);
+      add_nodes_and_edges(builder, *tiles.get(tile_id), connections, counts);
+      builder.StoreTileData();
+      phase1[tile_id] = std::move(connections);
+    }
+
+    for (const auto& tile_id : rebuilt) {
+      std::vector<parking_connection> inbound;
+      for (const auto& parking_tile : feeders[tile_id]) {
+        for (const auto& conn : phase1[parking_tile]) {
+          if (conn.way_node_id.Tile_Base() == tile_id) {
+            inbound.push_back(conn);
+          }
+        }
+      }
+      if (inbound.empty()) {
+        continue;
+      }
+
+      boost::sort(inbound);
+      GraphTileBuilder builder(live_dir, tile_id, true);
+      create_edges(builder, *tiles.get(tile_id), inbound);
+      builder.StoreTileData();
+    }
+
+    return rebuilt.size();
+  }
+
+  void write_index() {
+    parking_spaces::parking_index_builder index;
+    for (const auto& [_, connections] : phase1) {
+      add_to_index(index, connections);
+    }
+    index.write(opts.index);
+  }
+
+  correlation_options opts;
+  std::string live_dir;
+  std::string pristine_dir;
+  // reads the pristine tiles and keeps them cached between batches
+  std::mutex lock;
+  parking_spaces::tile_cache tiles;
+
+  // keyed by parking_space_key
+  std::unordered_map<uint64_t, parking_space_node> spaces;
+  std::unordered_map<GraphId, std::set<uint64_t>> spaces_by_tile;
+  // the projection of each parking tile, and its connections once the parking nodes are added
+  std::unordered_map<GraphId, projection_result> projections;
+  std::unordered_map<GraphId, std::vector<parking_connection>> phase1;
+  // the way node tiles each parking tile connects to, and the other way around
+  std::unordered_map<GraphId, std::set<GraphId>> feeds;
+  std::unordered_map<GraphId, std::set<GraphId>> feeders;
+};
+
+tile_patcher::tile_patcher(const boost::property_tree::ptree& pt, const std::string& pristine_dir) {
+  auto tile_dir = pt.get<std::string>("mjolnir.tile_dir");
+  if (!std::filesystem::exists(pristine_dir)) {
+    LOG_INFO("Keeping a pristine copy of {} in {}", tile_dir, pristine_dir);
+    std::filesystem::copy(tile_dir, pristine_dir, std::filesystem::copy_options::recursive);
+  }
+  impl_ = std::make_unique<impl>(pt, pristine_dir);
+}
+
+tile_patcher::~tile_patcher() = default;
+
+patch_result tile_patcher::apply(const std::vector<parking_change>& changes) {
+  patch_result result;
+  std::set<GraphId> changed;
+
+  for (const auto& change : changes) {
+    auto key = parking_space_key(change.space);
+    auto known = impl_->spaces.find(key);
+
+    if (change.type != parking_change::action::add && known == impl_->spaces.end()) {
+      result.rejected.push_back(key);
+      continue;
+    }
+    if (change.type != parking_change::action::remove &&
+        !impl_->tiles.get(impl_->tile_of(change.space))) {
+      result.rejected.push_back(key);
+      continue;
+    }
+
+    if (known != impl_->spaces.end()) {
+      auto old_tile = impl_->tile_of(known->second);
+      impl_->spaces_by_tile[old_tile].erase(key);
+      changed.insert(old_tile);
+      impl_->spaces.erase(known);
+    }
+
+    if (change.type != parking_change::action::remove) {
+      auto new_tile = impl_->tile_of(change.space);
+      impl_->spaces.emplace(key, change.space);
+      impl_->spaces_by_tile[new_tile].insert(key);
+      changed.insert(new_tile);
+    }
   }
+
+  result.tiles = impl_->rebuild(changed, result);
+  impl_->write_index();
+  return result;
+}
+
+size_t tile_patcher::size() const {
+  return impl_->spaces.size();
 }
 
 } // namespace parking_spaces
@@ -0,0 +1,251 @@
+#include "parking_spaces/parking_index.h"
+
+#include <valhalla/midgard/constants.h>
+#include <valhalla/midgard/distanceapproximator.h>
+#include <valhalla/midgard/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+
+using namespace valhalla::baldr;
+using namespace valhalla::midgard;
+
+namespace {
+
+constexpr char kMagic[8] = {'P', 'S', 'I', 'N', 'D', 'E', 'X', '\0'};
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kHilbertOrder = 16;
+constexpr uint32_t kGridSize = 1u << kHilbertOrder;
+
+struct grid_cell {
+  int64_t x;
+  int64_t y;
+};
+
+grid_cell to_cell(double lng, double lat) {
+  auto x = static_cast<int64_t>((lng + 180.) / 360. * kGridSize);
+  auto y = static_cast<int64_t>((lat + 90.) / 180. * kGridSize);
+  return {std::clamp<int64_t>(x, 0, kGridSize - 1), std::clamp<int64_t>(y, 0, kGridSize - 1)};
+}
+
+uint64_t hilbert_key(const grid_cell& cell) {
+  return parking_spaces::hilbert_key(static_cast<uint32_t>(cell.x), static_cast<uint32_t>(cell.y));
+}
+
+template <class T> void write_all(std::ofstream& out, const std::vector<T>& values) {
+  out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+}
+
+} // namespace
+
+namespace parking_spaces {
+
+uint64_t hilbert_key(uint32_t x, uint32_t y) {
+  uint64_t key = 0;
+  for (uint32_t s = kGridSize / 2; s > 0; s /= 2) {
+    uint32_t rx = (x & s) > 0;
+    uint32_t ry = (y & s) > 0;
+    key += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+    if (ry == 0) {
+      if (rx == 1) {
+        x = kGridSize - 1 - x;
+        y = kGridSize - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return key;
+}
+
+void parking_index_builder::add(const parking_index_entry& entry,
+                                const std::vector<GraphId>& way_nodes) {
+  std::lock_guard<std::mutex> l(lock_);
+  auto& added = entries_.emplace_back(entry);
+  added.first_way_node = way_nodes_.size();
+  added.way_node_count = way_nodes.size();
+  for (const auto& way_node : way_nodes) {
+    way_nodes_.push_back(way_node.value);
+  }
+}
+
+size_t parking_index_builder::size() const {
+  std::lock_guard<std::mutex> l(lock_);
+  return entries_.size();
+}
+
+void parking_index_builder::write(const std::string& path) const {
+  std::lock_guard<std::mutex> l(lock_);
+
+  // sort by cell along the curve, and by node within a cell so the file does not depend on the
+  // order the workers added the parking nodes in
+  std::vector<std::pair<uint64_t, size_t>> order;
+  order.reserve(entries_.size());
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    order.emplace_back(hilbert_key(to_cell(entries_[i].lng, entries_[i].lat)), i);
+  }
+  std::sort(order.begin(), order.end(), [this](const auto& a, const auto& b) {
+    return std::tie(a.first, entries_[a.second].node_id) <
+           std::tie(b.first, entries_[b.second].node_id);
+  });
+
+  std::vector<parking_index_cell> cells;
+  std::vector<parking_index_entry> entries;
+  std::vector<uint64_t> way_nodes;
+  entries.reserve(entries_.size());
+  way_nodes.reserve(way_nodes_.size());
+  for (const auto& [key, index] : order) {
+    if (cells.empty() || cells.back().key != key) {
+      cells.push_back({key, static_cast<uint32_t>(entries.size()), 0});
+    }
+    ++cells.back().entry_count;
+
+    auto entry = entries_[index];
+    entry.first_way_node = way_nodes.size();
+    way_nodes.insert(way_nodes.end(), way_nodes_.begin() + entries_[index].first_way_node,
+                     way_nodes_.begin() + entries_[index].first_way_node + entry.way_node_count);
+    entries.push_back(entry);
+  }
+
+  parking_index_header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.hilbert_order = kHilbertOrder;
+  header.cell_count = cells.size();
+  header.entry_count = entries.size();
+  header.way_node_count = way_nodes.size();
+
+  auto tmp_path = path + ".tmp";
+  std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  write_all(out, cells);
+  write_all(out, entries);
+  write_all(out, way_nodes);
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Failed to write parking index " + path);
+  }
+  std::filesystem::rename(tmp_path, path);
+
+  LOG_INFO("Wrote parking index {} with {} parking nodes in {} cells", path, entries.size(),
+           cells.size());
+}
+
+parking_index::parking_index(const std::string& path) {
+  auto size = std::filesystem::file_size(path);
+  if (size < sizeof(parking_index_header)) {
+    throw std::runtime_error("Not a parking index: " + path);
+  }
+  file_.map(path, size, POSIX_MADV_RANDOM, true);
+
+  header_ = reinterpret_cast<const parking_index_header*>(file_.get());
+  if (std::memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0 || header_->version != kVersion ||
+      header_->hilbert_order != kHilbertOrder) {
+    throw std::runtime_error("Not a parking index or unsupported version: " + path);
+  }
+
+  auto expected = sizeof(parking_index_header) +
+                  header_->cell_count * sizeof(parking_index_cell) +
+                  header_->entry_count * sizeof(parking_index_entry) +
+                  header_->way_node_count * sizeof(uint64_t);
+  if (size != expected) {
+    throw std::runtime_error("Truncated parking index: " + path);
+  }
+
+  const char* pos = file_.get() + sizeof(parking_index_header);
+  cells_ = {reinterpret_cast<const parking_index_cell*>(pos), header_->cell_count};
+  pos += cells_.size_bytes();
+  entries_ = {reinterpret_cast<const parking_index_entry*>(pos), header_->entry_count};
+  pos += entries_.size_bytes();
+  way_nodes_ = {reinterpret_cast<const uint64_t*>(pos), header_->way_node_count};
+}
+
+std::vector<parking_index::result> parking_index::nearest(const PointLL& ll,
+                                                          size_t k,
+                                                          float level,
+                                                          float max_distance) const {
+  if (k == 0 || cells_.empty()) {
+    return {};
+  }
+
+  // a cell is at least this wide and high around the query point
+  const double cell_meters =
+      std::min(180. / kGridSize * kMetersPerDegreeLat,
+               360. / kGridSize * DistanceApproximator<PointLL>::MetersPerLngDegree(ll.lat()));
+  const int64_t max_ring = static_cast<int64_t>(std::ceil(max_distance / cell_meters)) + 1;
+  const auto center = to_cell(ll.lng(), ll.lat());
+  DistanceApproximator<PointLL> approximator(ll);
+
+  // a max heap on distance holding the best k so far
+  auto further = [](const result& a, const result& b) { return a.distance < b.distance; };
+  std::priority_queue<result, std::vector<result>, decltype(further)> best(further);
+
+  auto visit = [&](int64_t x, int64_t y) {
+    if (x < 0 || y < 0 || x >= kGridSize || y >= kGridSize) {
+      return;
+    }
+    auto key = hilbert_key(grid_cell{x, y});
+    auto cell = std::lower_bound(cells_.begin(), cells_.end(), key,
+                                 [](const parking_index_cell& c, uint64_t value) {
+                                   return c.key < value;
+                                 });
+    if (cell == cells_.end() || cell->key != key) {
+      return;
+    }
+
+    for (const auto& entry : entries_.subspan(cell->first_entry, cell->entry_count)) {
+      if (level != kInvalidLevel && entry.level != level) {
+        continue;
+      }
+      auto distance = std::sqrt(approximator.DistanceSquared(PointLL(entry.lng, entry.lat)));
+      if (distance > max_distance) {
+        continue;
+      }
+      if (best.size() < k) {
+        best.push({&entry, distance});
+      } else if (distance < best.top().distance) {
+        best.pop();
+        best.push({&entry, distance});
+      }
+    }
+  };
+
+  for (int64_t ring = 0; ring <= max_ring; ++ring) {
+    // anything in this ring is at least (ring - 1) cells away from the query point
+    if (best.size() == k && best.top().distance <= (ring - 1) * cell_meters) {
+      break;
+    }
+
+    for (int64_t d = -ring; d <= ring; ++d) {
+      visit(center.x + d, center.y - ring);
+      if (ring > 0) {
+        visit(center.x + d, center.y + ring);
+      }
+    }
+    for (int64_t d = -ring + 1; d <= ring - 1; ++d) {
+      visit(center.x - ring, center.y + d);
+      visit(center.x + ring, center.y + d);
+    }
+  }
+
+  std::vector<result> results(best.size());
+  for (auto it = results.rbegin(); it != results.rend(); ++it) {
+    *it = best.top();
+    best.pop();
+  }
+  return results;
+}
+
+std::vector<GraphId> parking_index::way_nodes(const parking_index_entry& entry) const {
+  std::vector<GraphId> nodes;
+  for (auto value : way_nodes_.subspan(entry.first_way_node, entry.way_node_count)) {
+    nodes.emplace_back(value);
+  }
+  return nodes;
+}
+
+} // namespace parking_spaces
@@ -1,22 +1,41 @@
 #include "parking_spaces/parking_spaces.h"
 #include "parking_spaces/correlation.h"
 
+#include <valhalla/baldr/graphreader.h>
+#include <valhalla/baldr/tilehierarchy.h>
+#include <valhalla/midgard/aabb2.h>
+#include <valhalla/midgard/constants.h>
 #include <valhalla/midgard/logging.h>
+#include <valhalla/midgard/pointll.h>
 #include <valhalla/midgard/sequence.h>
+#include <valhalla/midgard/tiles.h>
 
 #include <boost/property_tree/ptree.hpp>
+#include <osmium/index/map/all.hpp>
+#include <osmium/io/header.hpp>
 #include <osmium/io/pbf_input.hpp>
+#include <osmium/osm/box.hpp>
+#include <osmium/osm/node.hpp>
+#include <osmium/osm/way.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+#include <memory>
 #include <regex>
+#include <thread>
+#include <unordered_set>
 
 namespace {
 
 constexpr std::string_view kTempSequencePath = "/parking_space.bin";
-constexpr std::string_view kParkingSpaceValue = "parking_space";
 constexpr std::string_view kParkingSpaceKey = "amenity";
 constexpr std::string_view kLevelKey = "level";
 const std::regex kFloatRegex("\\d+\\.(\\d+)");
 
+using namespace valhalla::baldr;
 using namespace valhalla::midgard;
 
 /**
@@ -40,11 +59,152 @@ std::pair<float, float> parse_level(std::string_view s) {
   return std::make_pair(value, precision);
 }
 
+/**
+ * Which local tiles exist in the graph, so that parking spaces far away from it are dropped
+ * while parsing instead of being written out and discarded during correlation
+ */
+class tile_coverage {
+public:
+  explicit tile_coverage(const boost::property_tree::ptree& config)
+      : tiles_(TileHierarchy::levels().back().tiles) {
+    GraphReader reader(config.get_child("mjolnir"));
+    auto tile_set = reader.GetTileSet(TileHierarchy::levels().back().level);
+    if (tile_set.empty()) {
+      LOG_WARN("No local tiles found, parsing parking spaces regardless of the graph coverage");
+      return;
+    }
+
+    covered_.resize(tiles_.TileCount(), false);
+    for (const auto& tile_id : tile_set) {
+      covered_[tile_id.tileid()] = true;
+    }
+    LOG_INFO("Parsing parking spaces within {} local tiles", tile_set.size());
+  }
+
+  /**
+   * @return whether the location lies in a tile of the graph
+   */
+  bool covers(const osmium::Location& location) const {
+    if (covered_.empty()) {
+      return true;
+    }
+    auto tile_id = tiles_.TileId(PointLL(location.lon(), location.lat()));
+    return tile_id >= 0 && covered_[tile_id];
+  }
+
+  /**
+   * @return whether the box touches any tile of the graph
+   */
+  bool intersects(const osmium::Box& box) const {
+    if (covered_.empty() || !box.valid()) {
+      return true;
+    }
+    AABB2<PointLL> bbox(box.bottom_left().lon(), box.bottom_left().lat(), box.top_right().lon(),
+                        box.top_right().lat());
+    auto tile_ids = tiles_.TileList(bbox);
+    return std::any_of(tile_ids.begin(), tile_ids.end(),
+                       [this](int32_t tile_id) { return covered_[tile_id]; });
+  }
+
+private:
+  Tiles<PointLL> tiles_;
+  std::vector<bool> covered_;
+};
+
+using location_index_t = osmium::index::map::Map<osmium::unsigned_object_id_type, osmium::Location>;
+
+/**
+ * Settings from the parking_spaces section of the config that affect parsing
+ */
+struct parse_options {
+  parking_spaces::parking_type type = parking_spaces::parking_type::car;
+  // also import parking spaces mapped as ways
+  bool ways = true;
+  // the osmium index type for the node locations of those ways
+  std::string location_index = "sparse_file_array";
+
+  explicit parse_options(const boost::property_tree::ptree& config)
+      : type(parking_spaces::parse_parking_type(
+            config.get<std::string>("parking_spaces.type", "car"))),
+        ways(config.get<bool>("parking_spaces.ways", true)),
+        location_index(
+            config.get<std::string>("parking_spaces.location_index", "sparse_file_array")) {
+  }
+};
+
+/**
+ * Creates the index holding the locations of the nodes of parking ways. The file based index
+ * types keep the locations in a memory mapped file at path rather than on the heap, so they scale
+ * to planet inputs.
+ */
+std::unique_ptr<location_index_t> create_location_index(const std::string& type,
+                                                        const std::string& path) {
+  const auto& factory =
+      osmium::index::MapFactory<osmium::unsigned_object_id_type, osmium::Location>::instance();
+  if (!factory.has_map_type(type)) {
+    throw std::invalid_argument("Unknown location index type: " + type);
+  }
+  return factory.create_map(type.ends_with("_file_array") ? type + "," + path : type);
+}
+
+/**
+ * The point representing a parking space mapped as a way: the centroid of the area for closed
+ * ways, the middle of the line otherwise. Parking spaces are small, so a local equirectangular
+ * frame around the first point is precise enough.
+ */
+PointLL representative_point(const std::vector<PointLL>& points) {
+  const auto& origin = points.front();
+  const double cos_lat = std::cos(origin.lat() * kRadPerDeg);
+  auto x = [&](const PointLL& p) { return (p.lng() - origin.lng()) * cos_lat; };
+  auto y = [&](const PointLL& p) { return p.lat() - origin.lat(); };
+
+  if (points.size() >= 4 && points.front() == points.back()) {
+    // twice the signed area, and the centroid scaled by six times the area
+    double area = 0., cx = 0., cy = 0.;
+    for (size_t i = 0; i + 1 < points.size(); ++i) {
+      double cross = x(points[i]) * y(points[i + 1]) - x(points[i + 1]) * y(points[i]);
+      area += cross;
+      cx += (x(points[i]) + x(points[i + 1])) * cross;
+      cy += (y(points[i]) + y(points[i + 1])) * cross;
+    }
+    // degenerate areas are treated like lines
+    if (std::abs(area) > 1e-14) {
+      return PointLL(origin.lng() + cx / (3. * area) / cos_lat, origin.lat() + cy / (3. * area));
+    }
+  }
+
+  std::vector<double> lengths{0.};
+  for (size_t i = 0; i + 1 < points.size(); ++i) {
+    lengths.push_back(lengths.back() + std::hypot(x(points[i + 1]) - x(points[i]),
+                                                  y(points[i + 1]) - y(points[i])));
+  }
+  auto half = lengths.back() / 2.;
+  auto after = std::upper_bound(lengths.begin(), lengths.end(), half);
+  if (after == lengths.end()) {
+    return origin;
+  }
+  auto i = std::distance(lengths.begin(), after) - 1;
+  double t = (half - lengths[i]) / (lengths[i + 1] - lengths[i]);
+  return PointLL(points[i].lng() + t * (points[i + 1].lng() - points[i].lng()),
+                 points[i].lat() + t * (points[i + 1].lat() - points[i].lat()));
+}
+
 class tag_parser {
 
 public:
-  explicit tag_parser(std::string_view tmp_sequence_path)
-      : sequence_(tmp_sequence_path.data(), true) {};
+  tag_parser(std::string_view tmp_sequence_path,
+             std::string_view parking_value,
+             const tile_coverage& coverage)
+      : sequence_(tmp_sequence_path.data(), true), parking_value_(parking_value),
+        coverage_(coverage) {};
+
+  size_t uncovered() const {
+    return uncovered_;
+  }
+
+  size_t size() const {
+    return sequence_.size();
+  }
 
   bool parse_node(const osmium::Node& node) {
     // nothing to do
@@ -52,36 +212,21 @@ public:
       return false;
     }
 
-    bool found_parking = false;
-    std::string level_value = "";
-    for (const auto& tag : node.tags()) {
-      if (std::string_view(tag.key()) == kParkingSpaceKey &&
-          std::string_view(tag.value()) == kParkingSpaceValue) {
-        found_parking = true;
-      }
-
-      if (std::string_view(tag.key()) == kLevelKey) {
-        level_value = tag.value();
-      }
+    std::string level_value;
+    if (!is_parking(node.tags(), level_value)) {
+      return false;
     }
 
-    if (!found_parking) {
+    if (!coverage_.covers(node.location())) {
+      ++uncovered_;
       return false;
     }
 
     // we've found one we care about
     parking_spaces::parking_space_node ps_node;
     ps_node.node = valhalla::mjolnir::OSMNode{uint64_t(node.id())};
-
-    if (!level_value.empty()) {
-      try {
-        std::tie(ps_node.level, ps_node.level_precision) = parse_level(level_value);
-      } catch (const std::invalid_argument& e) {
-        LOG_WARN("Found multi-level parking space: {}; error: {}", ps_node.node.osmid_, e.what());
-        return false;
-      }
-    } else {
-      ps_node.level = parking_spaces::kInvalidLevel;
+    if (!set_level(ps_node, level_value)) {
+      return false;
     }
 
     ps_node.node.set_latlng(node.location().lon(), node.location().lat());
@@ -90,49 +235,403 @@ public:
     return true;
   }
 
+  /**
+   * Remembers a way tagged as parking space, it is written once the locations of its nodes are
+   * known
+   */
+  void parse_way(const osmium::Way& way) {
+    std::string level_value;
+    if (way.nodes().empty() || !is_parking(way.tags(), level_value)) {
+      return;
+    }
+
+    parking_way parsed{{}, refs_.size(), way.nodes().size()};
+    parsed.space.node = valhalla::mjolnir::OSMNode{uint64_t(way.id())};
+    parsed.space.type = parking_spaces::osm_type::way;
+    if (!set_level(parsed.space, level_value)) {
+      return;
+    }
+
+    for (const auto& node_ref : way.nodes()) {
+      refs_.push_back(node_ref.positive_ref());
+    }
+    ways_.push_back(parsed);
+  }
+
+  bool has_ways() const {
+    return !ways_.empty();
+  }
+
+  /**
+   * @return the sorted ids of all nodes of the parking ways
+   */
+  std::vector<uint64_t> way_node_ids() const {
+    auto ids = refs_;
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return ids;
+  }
+
+  /**
+   * Writes the parking ways at their representative points, dropping those with nodes missing
+   * from the input
+   *
+   * @return the number of parking ways written
+   */
+  size_t resolve_ways(const location_index_t& locations) {
+    size_t written = 0, unresolved = 0;
+    std::vector<PointLL> points;
+    for (auto& way : ways_) {
+      points.clear();
+      for (size_t i = way.first_ref; i < way.first_ref + way.ref_count; ++i) {
+        auto location = locations.get_noexcept(refs_[i]);
+        if (!location.valid()) {
+          break;
+        }
+        points.emplace_back(location.lon(), location.lat());
+      }
+      if (points.size() != way.ref_count) {
+        ++unresolved;
+        continue;
+      }
+
+      auto point = representative_point(points);
+      if (!coverage_.covers(osmium::Location(point.lng(), point.lat()))) {
+        ++uncovered_;
+        continue;
+      }
+      way.space.node.set_latlng(point.lng(), point.lat());
+      sequence_.push_back(way.space);
+      ++written;
+    }
+
+    if (unresolved > 0) {
+      LOG_WARN("Dropped {} parking ways with nodes missing from the input", unresolved);
+    }
+    return written;
+  }
+
 protected:
+  struct parking_way {
+    parking_spaces::parking_space_node space;
+    size_t first_ref;
+    size_t ref_count;
+  };
+
+  /**
+   * @return whether the tags mark a parking space of the parsed kind, level_value is set to the
+   *         value of its level tag if it has one
+   */
+  bool is_parking(const osmium::TagList& tags, std::string& level_value) const {
+    bool found_parking = false;
+    for (const auto& tag : tags) {
+      if (std::string_view(tag.key()) == kParkingSpaceKey &&
+          std::string_view(tag.value()) == parking_value_) {
+        found_parking = true;
+      }
+
+      if (std::string_view(tag.key()) == kLevelKey) {
+        level_value = tag.value();
+      }
+    }
+    return found_parking;
+  }
+
+  bool set_level(parking_spaces::parking_space_node& ps_node, const std::string& level_value) {
+    if (level_value.empty()) {
+      ps_node.level = parking_spaces::kInvalidLevel;
+      return true;
+    }
+    try {
+      std::tie(ps_node.level, ps_node.level_precision) = parse_level(level_value);
+    } catch (const std::invalid_argument& e) {
+      LOG_WARN("Found multi-level parking space: {}; error: {}", ps_node.node.osmid_, e.what());
+      return false;
+    }
+    return true;
+  }
+
   sequence<parking_spaces::parking_space_node> sequence_;
+  std::string_view parking_value_;
+  const tile_coverage& coverage_;
+  size_t uncovered_ = 0;
+  // the parking ways waiting for their node locations, and the node ids of all of them
+  std::vector<parking_way> ways_;
+  std::vector<uint64_t> refs_;
 };
 
+osmium::io::Header read_header(std::string_view osm_file) {
+  osmium::io::Reader reader(osm_file.data(), osmium::osm_entity_bits::nothing);
+  auto header = reader.header();
+  reader.close();
+  return header;
+}
+
 /**
- * Parse nodes marked with amenity=parking_space into a sequence
- * of structs that we can use to correlate parking spaces to a Valhalla graph
+ * Calls visit for every entity of the given types in the file. In a file sorted by type all nodes
+ * come first, then all ways and then all relations, so reading stops at the first entity of a
+ * later type instead of decompressing the rest of the file.
  */
-void parse_osm(std::string_view osm_file, std::string_view tmp_dir, bool& found_any) {
-
-  osmium::io::Reader reader(osm_file.data(), osmium::osm_entity_bits::node);
-  std::string tmp_fp = tmp_dir.data() + std::string(kTempSequencePath.data());
-  tag_parser parser(tmp_fp);
-  while (const osmium::memory::Buffer buffer = reader.read()) {
+template <class visitor_t>
+void read_entities(std::string_view osm_file,
+                   osmium::osm_entity_bits::type entities,
+                   bool sorted,
+                   visitor_t visit) {
+  auto next = (entities & osmium::osm_entity_bits::way) ? osmium::osm_entity_bits::relation
+                                                        : osmium::osm_entity_bits::way;
+  osmium::io::Reader reader(osm_file.data(), sorted ? entities | next : entities);
+  bool done = false;
+  while (!done) {
+    const osmium::memory::Buffer buffer = reader.read();
+    if (!buffer) {
+      break;
+    }
     for (const osmium::memory::Item& item : buffer) {
-      found_any |= parser.parse_node(static_cast<const osmium::Node&>(item));
+      if (!(osmium::osm_entity_bits::from_item_type(item.type()) & entities)) {
+        LOG_INFO("Reached the first {}, skipping the rest of {}",
+                 osmium::item_type_to_name(item.type()), osm_file);
+        done = true;
+        break;
+      }
+      visit(item);
     }
   }
   reader.close(); // Explicit close to get an exception in case of an error.
+}
+
+/**
+ * Parse nodes and ways marked with amenity=parking_space (or the amenity of the given parking
+ * type) into a sequence of structs that we can use to correlate parking spaces to a Valhalla
+ * graph. Ways need a second pass over the nodes to find the locations of their nodes, which only
+ * happens if the first pass found any.
+ */
+size_t parse_osm(std::string_view osm_file,
+                 const std::string& tmp_fp,
+                 const parse_options& opts,
+                 const tile_coverage& coverage) {
+
+  tag_parser parser(tmp_fp, parking_spaces::parking_amenity(opts.type), coverage);
+
+  // PBF blocks carry no bounding box, but the file header usually does, so whole files that
+  // lie outside the graph are skipped
+  auto header = read_header(osm_file);
+  const auto& boxes = header.boxes();
+  if (!boxes.empty() && std::none_of(boxes.begin(), boxes.end(), [&](const osmium::Box& box) {
+        return coverage.intersects(box);
+      })) {
+    LOG_INFO("Skipping {}, it does not overlap any tile of the graph", osm_file);
+    return 0;
+  }
+
+  bool sorted = header.get("sorting") == "Type_then_ID";
+  auto entities = opts.ways ? osmium::osm_entity_bits::node | osmium::osm_entity_bits::way
+                            : osmium::osm_entity_bits::node;
+  read_entities(osm_file, entities, sorted, [&](const osmium::memory::Item& item) {
+    if (item.type() == osmium::item_type::node) {
+      parser.parse_node(static_cast<const osmium::Node&>(item));
+    } else {
+      parser.parse_way(static_cast<const osmium::Way&>(item));
+    }
+  });
+
+  if (parser.has_ways()) {
+    // only the nodes of parking ways are indexed, all others are skipped
+    const auto needed = parser.way_node_ids();
+    const auto index_path = tmp_fp + ".locations";
+    {
+      auto locations = create_location_index(opts.location_index, index_path);
+      read_entities(osm_file, osmium::osm_entity_bits::node, sorted,
+                    [&](const osmium::memory::Item& item) {
+                      const auto& node = static_cast<const osmium::Node&>(item);
+                      if (std::binary_search(needed.begin(), needed.end(), node.positive_id())) {
+                        locations->set(node.positive_id(), node.location());
+                      }
+                    });
+      locations->sort();
+      auto written = parser.resolve_ways(*locations);
+      LOG_INFO("Found {} parking ways with {} nodes in {}", written, needed.size(), osm_file);
+    }
+    std::filesystem::remove(index_path);
+  }
+
+  if (parser.uncovered() > 0) {
+    LOG_INFO("Dropped {} parking spaces outside the graph in {}", parser.uncovered(), osm_file);
+  }
   LOG_INFO("Wrote sequence to {}", tmp_fp);
+  return parser.size();
+}
+
+/**
+ * Parses all input files in parallel, each into its own sequence, then merges them into the
+ * sequence at tmp_dir + kTempSequencePath. Neighbouring extracts overlap, so only the first
+ * occurrence of every OSM id is kept.
+ *
+ * @return the number of parking spaces found
+ */
+size_t parse_all(const std::vector<std::string>& osm_files,
+                 const boost::property_tree::ptree& config) {
+  const auto tmp_dir = config.get<std::string>("mjolnir.tile_dir");
+  const auto merged_path = tmp_dir + std::string(kTempSequencePath);
+  const auto concurrency =
+      config.get<size_t>("mjolnir.concurrency", std::thread::hardware_concurrency());
+  const tile_coverage coverage(config);
+  const parse_options opts(config);
+
+  if (osm_files.size() == 1) {
+    return parse_osm(osm_files.front(), merged_path, opts, coverage);
+  }
+
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < osm_files.size(); ++i) {
+    paths.push_back(tmp_dir + "/parking_space_" + std::to_string(i) + ".bin");
+  }
+
+  std::atomic<size_t> next{0};
+  std::vector<std::exception_ptr> errors(osm_files.size());
+  std::vector<std::thread> threads(std::min(std::max<size_t>(concurrency, 1), osm_files.size()));
+  for (auto& thread : threads) {
+    thread = std::thread([&]() {
+      for (size_t i = next++; i < osm_files.size(); i = next++) {
+        try {
+          parse_osm(osm_files[i], paths[i], opts, coverage);
+        } catch (...) {
+          errors[i] = std::current_exception();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  size_t duplicates = 0, count = 0;
+  {
+    sequence<parking_spaces::parking_space_node> merged(merged_path, true);
+    std::unordered_set<uint64_t> seen;
+    for (const auto& path : paths) {
+      {
+        sequence<parking_spaces::parking_space_node> part(path, false);
+        for (auto space : part) {
+          if (seen.insert(parking_spaces::parking_space_key(space)).second) {
+            merged.push_back(space);
+          } else {
+            ++duplicates;
+          }
+        }
+      }
+      std::filesystem::remove(path);
+    }
+    count = seen.size();
+  }
+  LOG_INFO("Merged the parking spaces of {} files, dropped {} duplicates", osm_files.size(),
+           duplicates);
+
+  return count;
 }
 } // namespace
 
 namespace parking_spaces {
 
+parking_type parse_parking_type(std::string_view type) {
+  if (type == "car") {
+    return parking_type::car;
+  } else if (type == "bicycle") {
+    return parking_type::bicycle;
+  } else if (type == "motorcycle") {
+    return parking_type::motorcycle;
+  }
+  throw std::invalid_argument("Unknown parking type: " + std::string(type));
+}
+
+std::string_view parking_amenity(parking_type type) {
+  switch (type) {
+    case parking_type::bicycle:
+      return "bicycle_parking";
+    case parking_type::motorcycle:
+      return "motorcycle_parking";
+    case parking_type::car:
+    default:
+      return "parking_space";
+  }
+}
+
+std::vector<parking_space_node> read_parking_spaces(const boost::property_tree::ptree& config,
+                                                    const std::vector<std::string>& osm_files) {
+  auto tmp_dir = config.get<std::string>("mjolnir.tile_dir");
+
+  parse_all(osm_files, config);
+
+  auto path = std::string(tmp_dir) + kTempSequencePath.data();
+  std::vector<parking_space_node> spaces;
+  {
+    sequence<parking_space_node> parsed(path, false);
+    spaces.reserve(parsed.size());
+    for (auto space : parsed) {
+      spaces.push_back(space);
+    }
+  }
+  std::filesystem::remove(path);
+  return spaces;
+}
+
+void process_parking_spaces(const boost::property_tree::ptree& config, std::string_view osm_file) {
+  process_parking_spaces(config, std::vector<std::string>{std::string(osm_file)});
+}
+
 /**
  * Processing Pipeline:
- *   1. Parse OSM file, identify parking spaces and write them to a file
+ *   1. Parse the OSM files, identify parking spaces and write them to a file
  *   2. Correlate them to the graph
+ *
+ * With parking_spaces.parse_only only the first step runs, and with parking_spaces.shard only the
+ * second one, reading the parse output of an earlier run. parking_spaces.remove strips a previous
+ * import from the tiles instead, and parking_spaces.reimport does so before importing again.
  */
-void process_parking_spaces(const boost::property_tree::ptree& config, std::string_view osm_file) {
+void process_parking_spaces(const boost::property_tree::ptree& config,
+                            const std::vector<std::string>& osm_files) {
   LOG_INFO("Processing parking  spaces...");
   auto tmp_dir = config.get<std::string>("mjolnir.tile_dir");
 
-  bool found_any = false;
-  parse_osm(osm_file, tmp_dir, found_any);
+  if (config.get<bool>("parking_spaces.remove", false)) {
+    remove_parking_spaces(config);
+    return;
+  }
+  if (config.get<bool>("parking_spaces.reimport", false)) {
+    // every shard would strip all tiles, including those the other shards are importing into
+    if (config.get_optional<std::string>("parking_spaces.shard")) {
+      throw std::runtime_error("parking_spaces.reimport cannot be combined with "
+                               "parking_spaces.shard, shards start over from the pristine tiles");
+    }
+    remove_parking_spaces(config);
+  }
+
+  // the shards share the parse output and only read it
+  if (config.get_optional<std::string>("parking_spaces.shard")) {
+    auto parsed = config.get<std::string>("parking_spaces.parsed",
+                                          std::string(tmp_dir) + kTempSequencePath.data());
+    if (!std::filesystem::exists(parsed)) {
+      throw std::runtime_error("Sharded imports need the parse output at " + parsed +
+                               ", run the import with --parse-only first");
+    }
+    correlate_parking_spaces(config, parsed);
+    return;
+  }
+
+  auto found = parse_all(osm_files, config);
 
-  if (found_any) {
-    LOG_INFO("Done parsing parking spaces, found {} nodes",
-             sequence<parking_space_node>(std::string(tmp_dir) + kTempSequencePath.data(), false)
-                 .size());
+  if (found > 0) {
+    LOG_INFO("Done parsing parking spaces, found {}", found);
   } else {
-    LOG_WARN("Did not find any parking space nodes");
+    LOG_WARN("Did not find any parking spaces");
+    return;
+  }
+
+  if (config.get<bool>("parking_spaces.parse_only", false)) {
     return;
   }
 
@@ -0,0 +1,234 @@
+#include "parking_spaces/tile_extract.h"
+
+#include <valhalla/baldr/graphtile.h>
+#include <valhalla/midgard/logging.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+using namespace valhalla::baldr;
+
+namespace {
+
+constexpr std::string_view kStagingDir = "/parking_extract";
+constexpr std::string_view kIndexEntry = "index.bin";
+constexpr size_t kBlockSize = 512;
+constexpr size_t kSizeOffset = 124;
+constexpr size_t kChecksumOffset = 148;
+constexpr size_t kTypeflagOffset = 156;
+constexpr size_t kMagicOffset = 257;
+constexpr size_t kPrefixOffset = 345;
+
+size_t padded(size_t size) {
+  return (size + kBlockSize - 1) / kBlockSize * kBlockSize;
+}
+
+/**
+ * Rewrites the size field of a ustar header and recomputes its checksum.
+ */
+void set_entry_size(std::array<char, kBlockSize>& header, size_t size) {
+  std::snprintf(header.data() + kSizeOffset, 12, "%011zo", size);
+
+  // the checksum is computed with the checksum field itself set to spaces
+  std::fill_n(header.begin() + kChecksumOffset, 8, ' ');
+  unsigned int checksum = 0;
+  for (auto c : header) {
+    checksum += static_cast<unsigned char>(c);
+  }
+  std::snprintf(header.data() + kChecksumOffset, 8, "%06o", checksum);
+  header[kChecksumOffset + 7] = ' ';
+}
+
+/**
+ * @return whether the block is the ustar header of a regular file of that name with a valid
+ *         checksum
+ */
+bool is_entry_header(const char* header, const std::string& name) {
+  if (std::string_view(header + kMagicOffset, 5) != "ustar") {
+    return false;
+  }
+  if (header[kTypeflagOffset] != '0' && header[kTypeflagOffset] != '\0') {
+    return false;
+  }
+
+  unsigned int checksum = 0;
+  for (size_t i = 0; i < kBlockSize; ++i) {
+    checksum += i >= kChecksumOffset && i < kChecksumOffset + 8
+                    ? ' '
+                    : static_cast<unsigned char>(header[i]);
+  }
+  if (std::strtoul(std::string(header + kChecksumOffset, 8).c_str(), nullptr, 8) != checksum) {
+    return false;
+  }
+
+  // both fields are only null terminated if they are shorter than the field
+  auto field_value = [header](size_t offset, size_t length) {
+    std::string value(header + offset, length);
+    return value.substr(0, value.find('\0'));
+  };
+  const auto prefix = field_value(kPrefixOffset, 155);
+  const auto file = field_value(0, 100);
+  return (prefix.empty() ? file : prefix + "/" + file) == name;
+}
+
+const std::array<char, kBlockSize> kZeroBlock{};
+
+void write_padding(std::ofstream& out, size_t size) {
+  out.write(kZeroBlock.data(), padded(size) - size);
+}
+} // namespace
+
+namespace parking_spaces {
+
+tile_extract::tile_extract(const boost::property_tree::ptree& pt)
+    : tile_dir_(pt.get<std::string>("mjolnir.tile_dir")) {
+  auto output = pt.get_optional<std::string>("parking_spaces.output_extract");
+  auto input = pt.get<std::string>("mjolnir.tile_extract", "");
+  if (!output) {
+    // the graph reader would see the tiles of the extract while the tile builders modify those in
+    // mjolnir.tile_dir, mixing tiles of two different tile sets
+    if (!input.empty() && !pt.get<bool>("parking_spaces.dry_run", false)) {
+      throw std::runtime_error("Reading the tiles from mjolnir.tile_extract requires "
+                               "parking_spaces.output_extract to write the modified tiles to");
+    }
+    return;
+  }
+
+  if (input.empty() || !std::filesystem::is_regular_file(input)) {
+    throw std::runtime_error("Writing a tile extract requires mjolnir.tile_extract to point to an "
+                             "existing extract");
+  }
+  if (std::filesystem::weakly_canonical(input) == std::filesystem::weakly_canonical(*output)) {
+    throw std::runtime_error("The output extract must not overwrite the input extract " + input);
+  }
+
+  archive_ = std::make_shared<valhalla::midgard::tar>(input);
+  if (archive_->contents.empty()) {
+    throw std::runtime_error("No tiles found in extract " + input);
+  }
+  // finish() copies every entry with the single header block in front of it, so the entries have
+  // to follow each other without pax or GNU long name records, or any other entry, in between
+  const auto unsupported = "Extract " + input + " holds pax or GNU long name records or entries "
+                           "that are not regular files, which cannot be rewritten; build it with "
+                           "valhalla_build_extract";
+  std::vector<std::pair<const char*, size_t>> locations;
+  for (const auto& [name, location] : archive_->contents) {
+    if (!is_entry_header(location.first - kBlockSize, name)) {
+      throw std::runtime_error(unsupported + " (" + name + ")");
+    }
+    locations.push_back(location);
+  }
+  std::sort(locations.begin(), locations.end());
+  std::array<char, kBlockSize> first_block{};
+  std::ifstream(input, std::ios::binary).read(first_block.data(), first_block.size());
+  if (!std::equal(first_block.begin(), first_block.end(), locations.front().first - kBlockSize)) {
+    throw std::runtime_error(unsupported);
+  }
+  for (size_t i = 1; i < locations.size(); ++i) {
+    const auto& previous = locations[i - 1];
+    if (locations[i].first - kBlockSize != previous.first + padded(previous.second)) {
+      throw std::runtime_error(unsupported);
+    }
+  }
+
+  output_path_ = *output;
+  patch_only_ = pt.get<bool>("parking_spaces.patch_extract", false);
+
+  // modified tiles are unpacked here so GraphTileBuilder can work on them as usual
+  tile_dir_ += kStagingDir;
+  std::filesystem::remove_all(tile_dir_);
+  std::filesystem::create_directories(tile_dir_);
+
+  LOG_INFO("Reading {} entries from extract {}", archive_->contents.size(), input);
+}
+
+void tile_extract::stage(const GraphId& tile_id) {
+  if (!enabled()) {
+    return;
+  }
+
+  auto suffix = GraphTile::FileSuffix(tile_id.Tile_Base());
+  {
+    std::lock_guard<std::mutex> l(lock_);
+    if (!modified_.insert(suffix).second) {
+      return;
+    }
+  }
+
+  auto entry = archive_->contents.find(suffix);
+  if (entry == archive_->contents.end()) {
+    throw std::runtime_error("Tile " + suffix + " is not part of the extract");
+  }
+
+  auto path = std::filesystem::path(tile_dir_) / suffix;
+  std::filesystem::create_directories(path.parent_path());
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(entry->second.first, entry->second.second);
+}
+
+void tile_extract::finish() {
+  if (!enabled()) {
+    return;
+  }
+
+  // keep the order of the input extract so unmodified ranges are copied sequentially
+  std::vector<std::pair<std::string, std::pair<const char*, size_t>>>
+      entries(archive_->contents.begin(), archive_->contents.end());
+  std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+    return a.second.first < b.second.first;
+  });
+
+  std::ofstream out(output_path_, std::ios::binary | std::ios::trunc);
+  size_t copied = 0, written = 0;
+  for (const auto& [name, location] : entries) {
+    // the index stores byte offsets which no longer hold once a tile changes size, the reader
+    // falls back to scanning the tar headers without it
+    if (name == kIndexEntry) {
+      continue;
+    }
+
+    const auto* header_start = location.first - kBlockSize;
+    if (!modified_.count(name)) {
+      if (!patch_only_) {
+        out.write(header_start, kBlockSize + padded(location.second));
+        ++copied;
+      }
+      continue;
+    }
+
+    std::ifstream staged(std::filesystem::path(tile_dir_) / name, std::ios::binary);
+    std::string tile{std::istreambuf_iterator<char>(staged), std::istreambuf_iterator<char>()};
+
+    std::array<char, kBlockSize> header;
+    std::copy_n(header_start, kBlockSize, header.begin());
+    set_entry_size(header, tile.size());
+
+    out.write(header.data(), header.size());
+    out.write(tile.data(), tile.size());
+    write_padding(out, tile.size());
+    ++written;
+  }
+
+  // a tar archive ends with two empty blocks
+  out.write(kZeroBlock.data(), kZeroBlock.size());
+  out.write(kZeroBlock.data(), kZeroBlock.size());
+  out.close();
+  if (!out) {
+    throw std::runtime_error("Failed to write tile extract " + output_path_);
+  }
+
+  LOG_INFO("Wrote extract {}: {} modified tiles, {} tiles copied unchanged", output_path_, written,
+           copied);
+  std::filesystem::remove_all(tile_dir_);
+}
+
+} // namespace parking_spaces
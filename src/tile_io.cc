@@ -0,0 +1,412 @@
+#include "parking_spaces/tile_io.h"
+#include "parking_spaces/parking_index.h"
+
+#include <valhalla/baldr/graphtile.h>
+#include <valhalla/baldr/tilehierarchy.h>
+#include <valhalla/midgard/logging.h>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+using namespace valhalla::baldr;
+using namespace valhalla::mjolnir;
+
+namespace {
+
+constexpr size_t kNoSlot = std::numeric_limits<size_t>::max();
+
+uint64_t pack_run(uint64_t begin, uint64_t end) {
+  return (begin << 32) | end;
+}
+
+uint64_t run_begin(uint64_t run) {
+  return run >> 32;
+}
+
+uint64_t run_end(uint64_t run) {
+  return run & 0xffffffff;
+}
+
+uint64_t run_length(uint64_t run) {
+  return run_end(run) - run_begin(run);
+}
+
+/**
+ * The position of the tile along the Hilbert curve through the tiles of its level
+ */
+uint64_t curve_key(const GraphId& tile_id) {
+  for (const auto& level : TileHierarchy::levels()) {
+    if (level.level == tile_id.level()) {
+      auto columns = static_cast<uint32_t>(level.tiles.ncolumns());
+      return (static_cast<uint64_t>(tile_id.level()) << 32) |
+             parking_spaces::hilbert_key(tile_id.tileid() % columns, tile_id.tileid() / columns);
+    }
+  }
+  return static_cast<uint64_t>(tile_id.level()) << 32;
+}
+
+} // namespace
+
+namespace parking_spaces {
+
+tile_cache::tile_cache(const boost::property_tree::ptree& pt, std::mutex& lock, size_t max_bytes)
+    : reader_(pt), lock_(lock), max_bytes_(max_bytes) {
+  for (const auto& level : TileHierarchy::levels()) {
+    level_offsets_.resize(level.level + 1, slot_count_);
+    level_offsets_[level.level] = slot_count_;
+    slot_count_ += level.tiles.TileCount();
+  }
+  level_offsets_.push_back(slot_count_);
+  slots_ = std::make_unique<slot[]>(slot_count_);
+}
+
+tile_cache::~tile_cache() = default;
+
+size_t tile_cache::slot_of(const GraphId& tile_id) const {
+  auto level = tile_id.level();
+  if (level + 1 >= level_offsets_.size() ||
+      tile_id.tileid() >= level_offsets_[level + 1] - level_offsets_[level]) {
+    return kNoSlot;
+  }
+  return level_offsets_[level] + tile_id.tileid();
+}
+
+graph_tile_ptr tile_cache::lookup(const slot& entry) {
+  graph_tile_ptr tile;
+  ++readers_;
+  if (const auto* cached = entry.tile.load()) {
+    tile = cached->tile;
+  }
+  --readers_;
+  return tile;
+}
+
+graph_tile_ptr tile_cache::get(const GraphId& tile_id) {
+  auto index = slot_of(tile_id.Tile_Base());
+  if (index == kNoSlot) {
+    // transit tiles and the like are not worth caching
+    std::lock_guard<std::mutex> file(file_lock(tile_id));
+    std::lock_guard<std::mutex> l(lock_);
+    auto tile = reader_.GetGraphTile(tile_id);
+    reader_.Clear();
+    return tile;
+  }
+
+  auto& entry = slots_[index];
+  auto tile = lookup(entry);
+  if (tile || entry.missing.load()) {
+    entry.referenced.store(true, std::memory_order_relaxed);
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return tile;
+  }
+
+  // the file lock keeps the writer from replacing the tile while the reader loads it
+  std::lock_guard<std::mutex> file(file_lock(tile_id));
+  std::lock_guard<std::mutex> l(lock_);
+  // another thread may have read the tile while we were waiting for the lock
+  tile = lookup(entry);
+  if (tile || entry.missing.load()) {
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return tile;
+  }
+
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  tile = reader_.GetGraphTile(tile_id.Tile_Base());
+  // the reader only loads, the tiles are kept here
+  reader_.Clear();
+  if (!tile) {
+    entry.missing.store(true);
+    missing_.push_back(index);
+    return tile;
+  }
+
+  auto cached = std::make_unique<const cached_tile>(cached_tile{tile, tile->header()->end_offset()});
+  make_room(cached->bytes);
+  bytes_ += cached->bytes;
+  entry.referenced.store(true, std::memory_order_relaxed);
+  entry.tile.store(cached.get());
+  resident_.emplace_back(index, std::move(cached));
+  return tile;
+}
+
+void tile_cache::make_room(size_t bytes) {
+  // tiles evicted while lookups were in progress may be freed by now
+  reclaim();
+
+  // the hand passes every tile at most twice: once to clear its referenced bit, once to evict it
+  size_t steps = 2 * resident_.size();
+  for (; steps > 0 && !resident_.empty() && bytes_ + retired_bytes_ + bytes > max_bytes_;
+       --steps) {
+    hand_ %= resident_.size();
+    auto& [index, cached] = resident_[hand_];
+    if (slots_[index].referenced.exchange(false, std::memory_order_relaxed)) {
+      ++hand_;
+      continue;
+    }
+
+    slots_[index].tile.store(nullptr);
+    bytes_ -= cached->bytes;
+    retired_bytes_ += cached->bytes;
+    retired_.push_back(std::move(cached));
+    if (hand_ + 1 != resident_.size()) {
+      resident_[hand_] = std::move(resident_.back());
+    }
+    resident_.pop_back();
+    evictions_.fetch_add(1, std::memory_order_relaxed);
+  }
+  reclaim();
+}
+
+void tile_cache::reclaim() {
+  // a lookup that started before a tile was evicted may still be copying its pointer, once there
+  // are no lookups in progress every lookup holds its own reference to the tiles it found
+  if (!retired_.empty() && readers_.load() == 0) {
+    retired_.clear();
+    retired_bytes_ = 0;
+  }
+}
+
+void tile_cache::clear() {
+  std::lock_guard<std::mutex> l(lock_);
+  for (auto& [index, cached] : resident_) {
+    slots_[index].tile.store(nullptr);
+    retired_bytes_ += cached->bytes;
+    retired_.push_back(std::move(cached));
+  }
+  resident_.clear();
+  for (auto index : missing_) {
+    slots_[index].missing.store(false);
+  }
+  missing_.clear();
+  bytes_ = 0;
+  hand_ = 0;
+  reclaim();
+}
+
+tile_cache::statistics tile_cache::stats() const {
+  std::lock_guard<std::mutex> l(lock_);
+  return {hits_.load(), misses_.load(), evictions_.load(), bytes_};
+}
+
+tile_schedule::tile_schedule(std::vector<GraphId> tiles, size_t workers)
+    : tiles_(std::move(tiles)), runs_(std::max<size_t>(workers, 1)) {
+  if (tiles_.size() > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("Too many tiles to schedule");
+  }
+
+  std::vector<std::pair<uint64_t, GraphId>> keyed;
+  keyed.reserve(tiles_.size());
+  for (const auto& tile_id : tiles_) {
+    keyed.emplace_back(curve_key(tile_id), tile_id);
+  }
+  std::sort(keyed.begin(), keyed.end());
+  for (size_t i = 0; i < keyed.size(); ++i) {
+    tiles_[i] = keyed[i].second;
+  }
+
+  for (size_t i = 0; i < runs_.size(); ++i) {
+    runs_[i].store(
+        pack_run(tiles_.size() * i / runs_.size(), tiles_.size() * (i + 1) / runs_.size()));
+  }
+}
+
+std::optional<GraphId> tile_schedule::next(size_t worker) {
+  auto& own = runs_[worker];
+  auto run = own.load();
+  while (run_length(run) > 0) {
+    if (own.compare_exchange_weak(run, pack_run(run_begin(run) + 1, run_end(run)))) {
+      return tiles_[run_begin(run)];
+    }
+  }
+
+  // the back half of the longest run is the furthest from where its worker is
+  while (true) {
+    auto* longest = &own;
+    run = 0;
+    for (auto& other : runs_) {
+      auto other_run = other.load();
+      if (run_length(other_run) > run_length(run)) {
+        longest = &other;
+        run = other_run;
+      }
+    }
+    // tiles stolen by a worker that has not yet made them its run are left to that worker
+    if (run_length(run) == 0) {
+      return std::nullopt;
+    }
+
+    auto stolen = (run_length(run) + 1) / 2;
+    auto first = run_end(run) - stolen;
+    if (longest->compare_exchange_strong(run, pack_run(run_begin(run), first))) {
+      // no one else touches our run while it is empty
+      own.store(pack_run(first + 1, run_end(run)));
+      return tiles_[first];
+    }
+  }
+}
+
+tile_prefetcher::tile_prefetcher(tile_cache& cache,
+                                 tile_extract& extract,
+                                 tile_journal* journal,
+                                 tile_source next_tile,
+                                 size_t depth,
+                                 builder_filter with_builder)
+    : cache_(cache), extract_(extract), journal_(journal),
+      next_tile_(std::move(next_tile)), depth_(std::max<size_t>(depth, 1)),
+      with_builder_(std::move(with_builder)) {
+  thread_ = std::thread(&tile_prefetcher::run, this);
+}
+
+tile_prefetcher::~tile_prefetcher() {
+  {
+    std::lock_guard<std::mutex> l(queue_lock_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void tile_prefetcher::run() {
+  try {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> l(queue_lock_);
+        cv_.wait(l, [this] { return stop_ || ready_.size() < depth_; });
+        if (stop_) {
+          return;
+        }
+      }
+
+      auto tile_id = next_tile_();
+      if (!tile_id) {
+        break;
+      }
+      prefetched_tile loaded;
+      loaded.tile_id = *tile_id;
+      loaded.tile = cache_.get(*tile_id);
+      if (with_builder_(*tile_id)) {
+        // no one else writes the tile in this phase, so it is loaded and staged without a lock
+        const std::string* dir = &extract_.tile_dir();
+        if (journal_) {
+          dir = &journal_->stage(*tile_id);
+        } else {
+          extract_.stage(*tile_id);
+        }
+        loaded.builder = std::make_unique<GraphTileBuilder>(*dir, *tile_id, true);
+      }
+
+      {
+        std::lock_guard<std::mutex> l(queue_lock_);
+        ready_.push_back(std::move(loaded));
+      }
+      cv_.notify_all();
+    }
+
+    {
+      std::lock_guard<std::mutex> l(queue_lock_);
+      done_ = true;
+    }
+    cv_.notify_all();
+  } catch (...) {
+    {
+      std::lock_guard<std::mutex> l(queue_lock_);
+      error_ = std::current_exception();
+    }
+    cv_.notify_all();
+  }
+}
+
+std::optional<prefetched_tile> tile_prefetcher::next() {
+  std::unique_lock<std::mutex> l(queue_lock_);
+  cv_.wait(l, [this] { return !ready_.empty() || done_ || error_; });
+  if (ready_.empty()) {
+    if (error_) {
+      std::rethrow_exception(error_);
+    }
+    return std::nullopt;
+  }
+
+  auto loaded = std::move(ready_.front());
+  ready_.pop_front();
+  l.unlock();
+  cv_.notify_all();
+  return loaded;
+}
+
+tile_writer::tile_writer(tile_cache& cache, size_t capacity, tile_journal* journal)
+    : cache_(cache), capacity_(std::max<size_t>(capacity, 1)), journal_(journal) {
+  thread_ = std::thread(&tile_writer::run, this);
+}
+
+tile_writer::~tile_writer() {
+  if (thread_.joinable()) {
+    try {
+      finish();
+    } catch (const std::exception& e) {
+      LOG_ERROR("Failed to store tile data: {}", e.what());
+    }
+  }
+}
+
+void tile_writer::push(std::unique_ptr<GraphTileBuilder> builder) {
+  std::unique_lock<std::mutex> l(queue_lock_);
+  cv_.wait(l, [this] { return pending_.size() < capacity_ || error_; });
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+
+  pending_.push_back(std::move(builder));
+  l.unlock();
+  cv_.notify_all();
+}
+
+void tile_writer::finish() {
+  {
+    std::lock_guard<std::mutex> l(queue_lock_);
+    done_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+}
+
+void tile_writer::run() {
+  while (true) {
+    std::unique_ptr<GraphTileBuilder> builder;
+    {
+      std::unique_lock<std::mutex> l(queue_lock_);
+      cv_.wait(l, [this] { return !pending_.empty() || done_; });
+      if (pending_.empty()) {
+        return;
+      }
+      builder = std::move(pending_.front());
+      pending_.pop_front();
+    }
+    cv_.notify_all();
+
+    try {
+      std::lock_guard<std::mutex> l(cache_.file_lock(builder->header()->graphid()));
+      LOG_INFO("Storing local tile data, tile id: {}", builder->header()->graphid().tileid());
+      builder->StoreTileData();
+      if (journal_) {
+        journal_->commit(builder->header()->graphid());
+      }
+    } catch (...) {
+      {
+        std::lock_guard<std::mutex> l(queue_lock_);
+        if (!error_) {
+          error_ = std::current_exception();
+        }
+      }
+      cv_.notify_all();
+    }
+  }
+}
+
+} // namespace parking_spaces
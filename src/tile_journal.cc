@@ -0,0 +1,146 @@
+#include "parking_spaces/tile_journal.h"
+
+#include <valhalla/baldr/graphtile.h>
+#include <valhalla/midgard/logging.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <format>
+#include <stdexcept>
+
+using namespace valhalla::baldr;
+
+namespace {
+
+constexpr std::string_view kLogFile = "/journal.log";
+constexpr std::string_view kHeader = "parking_spaces journal 1 ";
+
+/**
+ * Copies a file so that the target is either complete or does not exist
+ */
+void copy_atomically(const std::filesystem::path& from, const std::filesystem::path& to) {
+  std::filesystem::create_directories(to.parent_path());
+  auto tmp = to;
+  tmp += ".tmp";
+  std::filesystem::copy_file(from, tmp, std::filesystem::copy_options::overwrite_existing);
+  std::filesystem::rename(tmp, to);
+}
+
+/**
+ * Links a file so that the target is either complete or does not exist, copying it if the two
+ * paths are on different file systems. Only safe for files that are replaced rather than written
+ * in place, as both paths share the contents.
+ */
+void link_atomically(const std::filesystem::path& from, const std::filesystem::path& to) {
+  std::filesystem::create_directories(to.parent_path());
+  auto tmp = to;
+  tmp += ".tmp";
+  std::filesystem::remove(tmp);
+  std::error_code ec;
+  std::filesystem::create_hard_link(from, tmp, ec);
+  if (ec) {
+    copy_atomically(from, to);
+    return;
+  }
+  std::filesystem::rename(tmp, to);
+}
+
+} // namespace
+
+namespace parking_spaces {
+
+tile_journal::tile_journal(const std::string& tile_dir, const std::string& dir, uint64_t fingerprint)
+    : tile_dir_(tile_dir), dir_(dir), staging_dir_(dir + "/staging") {
+  const auto log_path = dir_ + std::string(kLogFile);
+  const auto header = std::format("{}{:016x}", kHeader, fingerprint);
+
+  std::ifstream previous(log_path);
+  std::string line;
+  if (previous && std::getline(previous, line)) {
+    if (line != header) {
+      throw std::runtime_error(dir_ + " holds the journal of an import of other parking spaces or "
+                                      "with other options, remove it to start over");
+    }
+    // the last line is cut off if the process died while writing it, that tile is built again
+    while (std::getline(previous, line) && !previous.eof()) {
+      int phase = 0;
+      uint64_t value = 0;
+      if (std::sscanf(line.c_str(), "%d %" SCNu64, &phase, &value) == 2 &&
+          (phase == 1 || phase == 2)) {
+        done_[phase - 1].insert(GraphId(value));
+      }
+    }
+    resumed_ = true;
+    LOG_INFO("Resuming the import from {}, {} tiles were done in phase 1 and {} in phase 2", dir_,
+             done_[0].size(), done_[1].size());
+  } else {
+    std::filesystem::remove_all(dir_);
+    std::filesystem::create_directories(dir_);
+  }
+  previous.close();
+
+  // the log is written again without a cut off line, so appending to it starts on a fresh line
+  {
+    std::ofstream log(log_path + ".tmp", std::ios::trunc);
+    log << header << '\n';
+    for (int phase = 1; phase <= 2; ++phase) {
+      for (const auto& tile_id : done_[phase - 1]) {
+        log << phase << ' ' << tile_id.value << '\n';
+      }
+    }
+    if (!log.flush()) {
+      throw std::runtime_error("Failed to write the journal " + log_path);
+    }
+  }
+  std::filesystem::rename(log_path + ".tmp", log_path);
+  log_.open(log_path, std::ios::app);
+
+  // whatever is left in the staging directory was never committed
+  std::filesystem::remove_all(staging_dir_);
+  std::filesystem::create_directories(staging_dir_);
+}
+
+void tile_journal::begin(int phase) {
+  std::lock_guard<std::mutex> l(lock_);
+  phase_ = phase;
+}
+
+bool tile_journal::done(int phase, const GraphId& tile_id) const {
+  std::lock_guard<std::mutex> l(lock_);
+  return done_[phase - 1].contains(tile_id.Tile_Base());
+}
+
+const std::string& tile_journal::stage(const GraphId& tile_id) {
+  const auto suffix = GraphTile::FileSuffix(tile_id.Tile_Base());
+  const auto before = std::filesystem::path(dir_) / std::format("phase{}", phase_) / suffix;
+
+  // the first attempt at this tile in this phase finds it untouched in the tile directory. Commits
+  // replace tiles by renaming, so a link keeps the untouched tile without copying it. The staged
+  // tile is written in place by the tile builder and needs a copy of its own
+  if (!std::filesystem::exists(before)) {
+    link_atomically(std::filesystem::path(tile_dir_) / suffix, before);
+  }
+  copy_atomically(before, std::filesystem::path(staging_dir_) / suffix);
+  return staging_dir_;
+}
+
+void tile_journal::commit(const GraphId& tile_id) {
+  const auto suffix = GraphTile::FileSuffix(tile_id.Tile_Base());
+  std::filesystem::rename(std::filesystem::path(staging_dir_) / suffix,
+                          std::filesystem::path(tile_dir_) / suffix);
+
+  std::lock_guard<std::mutex> l(lock_);
+  log_ << phase_ << ' ' << tile_id.Tile_Base().value << '\n';
+  if (!log_.flush()) {
+    throw std::runtime_error("Failed to write the journal " + dir_ + std::string(kLogFile));
+  }
+  done_[phase_ - 1].insert(tile_id.Tile_Base());
+}
+
+void tile_journal::finish() {
+  log_.close();
+  std::filesystem::remove_all(dir_);
+}
+
+} // namespace parking_spaces
@@ -0,0 +1,377 @@
+// End-to-end benchmark of process_parking_spaces on synthetic cities.
+//
+// A city is a square grid of streets with parking lots in the blocks between them. The graph is
+// built once, then the import runs on a fresh copy of the tiles for every thread count in a
+// forked child process. The child inherits the memory the graph build left resident in this
+// process, so the peak RSS of a run is the child's peak from its rusage minus its RSS at the fork.
+
+#include "cxxopts.hpp"
+#include "parking_spaces/parking_spaces.h"
+
+#include <valhalla/midgard/constants.h>
+#include <valhalla/midgard/distanceapproximator.h>
+#include <valhalla/midgard/logging.h>
+#include <valhalla/midgard/pointll.h>
+#include <valhalla/mjolnir/util.h>
+#include <valhalla/test.h>
+
+#include <osmium/builder/attr.hpp>
+#include <osmium/io/header.hpp>
+#include <osmium/io/pbf_output.hpp>
+#include <osmium/io/writer.hpp>
+#include <osmium/memory/buffer.hpp>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace valhalla;
+
+namespace {
+
+struct city_options {
+  size_t streets = 20;
+  size_t lots = 200;
+  size_t spaces_per_lot = 50;
+  size_t levels = 1;
+  double block_size = 150.;
+  // the last lots have their spaces mapped as areas instead of nodes
+  size_t area_lots = 0;
+};
+
+/**
+ * Writes a grid of streets with parking lots to a PBF and returns the number of parking spaces.
+ * Street nodes get ids from 1, parking spaces and the nodes of parking aisles are numbered after
+ * them. Lots on several levels get a parking aisle per level along their northern side, as the
+ * spaces of a level are only connected to edges on the same level. The file is sorted by type
+ * and id and says so in its header, like most extracts do.
+ */
+size_t write_city(const city_options& city, const midgard::PointLL& origin, const std::string& pbf) {
+  using namespace osmium::builder::attr;
+
+  const double lat_per_meter = 1. / midgard::kMetersPerDegreeLat;
+  const double lng_per_meter =
+      1. / midgard::DistanceApproximator<midgard::PointLL>::MetersPerLngDegree(origin.lat());
+  auto location = [&](double x, double y) {
+    return osmium::Location(origin.lng() + x * lng_per_meter, origin.lat() - y * lat_per_meter);
+  };
+  auto street_node = [&](size_t row, size_t column) {
+    return static_cast<osmium::object_id_type>(row * city.streets + column + 1);
+  };
+
+  osmium::memory::Buffer buffer{1024 * 1024, osmium::memory::Buffer::auto_grow::yes};
+  for (size_t row = 0; row < city.streets; ++row) {
+    for (size_t column = 0; column < city.streets; ++column) {
+      add_node(buffer, _id(street_node(row, column)), _version(1),
+               _location(location(column * city.block_size, row * city.block_size)));
+    }
+  }
+
+  // lots are spread round robin over the blocks, each lot is a square of spaces 3m apart
+  const size_t blocks_per_row = std::max<size_t>(city.streets, 2) - 1;
+  const size_t blocks = blocks_per_row * blocks_per_row;
+  const size_t lot_side = std::ceil(std::sqrt(static_cast<double>(city.spaces_per_lot)));
+  const double lot_size = lot_side * 3.;
+  const size_t lots_per_block_row =
+      std::max<size_t>(1, static_cast<size_t>((city.block_size - 20.) / (lot_size + 5.)));
+
+  auto space_id = street_node(city.streets, 0);
+  struct aisle {
+    osmium::object_id_type from;
+    osmium::object_id_type to;
+    size_t level;
+  };
+  std::vector<aisle> aisles;
+  std::vector<std::pair<std::vector<osmium::NodeRef>, size_t>> areas;
+  for (size_t lot = 0; lot < city.lots; ++lot) {
+    size_t block = lot % blocks;
+    size_t slot = (lot / blocks) % (lots_per_block_row * lots_per_block_row);
+    double lot_x = (block % blocks_per_row) * city.block_size + 10. +
+                   (slot % lots_per_block_row) * (lot_size + 5.);
+    double lot_y = (block / blocks_per_row) * city.block_size + 10. +
+                   (slot / lots_per_block_row) * (lot_size + 5.);
+
+    for (size_t space = 0; space < city.spaces_per_lot; ++space) {
+      double x = lot_x + (space % lot_side) * 3., y = lot_y + (space / lot_side) * 3.;
+      auto loc = location(x, y);
+      if (lot + city.area_lots >= city.lots) {
+        // a closed way around the 2.5m square north east of where the node would be
+        const std::pair<double, double> corners[] = {{0., 0.}, {2.5, 0.}, {2.5, -2.5}, {0., -2.5}};
+        std::vector<osmium::NodeRef> outline;
+        for (auto [dx, dy] : corners) {
+          add_node(buffer, _id(space_id), _version(1), _location(location(x + dx, y + dy)));
+          outline.emplace_back(space_id++);
+        }
+        outline.push_back(outline.front());
+        areas.emplace_back(std::move(outline), space % city.levels);
+      } else if (city.levels > 1) {
+        add_node(buffer, _id(space_id++), _version(1), _location(loc),
+                 _tag("amenity", "parking_space"),
+                 _tag("level", std::to_string(space % city.levels)));
+      } else {
+        add_node(buffer, _id(space_id++), _version(1), _location(loc),
+                 _tag("amenity", "parking_space"));
+      }
+    }
+
+    // the aisles of the levels lie half a meter apart, 3m north of the first row of spaces
+    for (size_t level = 0; city.levels > 1 && level < city.levels; ++level) {
+      double y = lot_y - 3. - level * 0.5;
+      add_node(buffer, _id(space_id), _version(1), _location(location(lot_x, y)));
+      add_node(buffer, _id(space_id + 1), _version(1), _location(location(lot_x + lot_size, y)));
+      aisles.push_back({space_id, space_id + 1, level});
+      space_id += 2;
+    }
+  }
+
+  // one way per street, the graph builder splits them at the intersections
+  osmium::object_id_type way_id = 1;
+  for (size_t street = 0; street < city.streets; ++street) {
+    std::vector<osmium::NodeRef> row_nodes, column_nodes;
+    for (size_t i = 0; i < city.streets; ++i) {
+      row_nodes.push_back(street_node(street, i));
+      column_nodes.push_back(street_node(i, street));
+    }
+    for (const auto* way_nodes : {&row_nodes, &column_nodes}) {
+      add_way(buffer, _id(way_id++), _version(1), _nodes(*way_nodes),
+              _tag("highway", "residential"));
+    }
+  }
+
+  for (const auto& lot_aisle : aisles) {
+    add_way(buffer, _id(way_id++), _version(1), _nodes({lot_aisle.from, lot_aisle.to}),
+            _tag("highway", "service"), _tag("service", "parking_aisle"),
+            _tag("level", std::to_string(lot_aisle.level)));
+  }
+
+  for (const auto& [outline, level] : areas) {
+    if (city.levels > 1) {
+      add_way(buffer, _id(way_id++), _version(1), _nodes(outline), _tag("amenity", "parking_space"),
+              _tag("level", std::to_string(level)));
+    } else {
+      add_way(buffer, _id(way_id++), _version(1), _nodes(outline), _tag("amenity", "parking_space"));
+    }
+  }
+
+  osmium::io::Header header;
+  header.set("sorting", "Type_then_ID");
+  osmium::io::Writer writer{pbf, header, osmium::io::overwrite::allow};
+  writer(std::move(buffer));
+  writer.close();
+
+  return city.lots * city.spaces_per_lot;
+}
+
+struct run_result {
+  double seconds;
+  long peak_rss_kb;
+};
+
+/**
+ * @return the resident set size of this process in KB
+ */
+long current_rss_kb() {
+  std::ifstream status("/proc/self/status");
+  for (std::string line; std::getline(status, line);) {
+    if (line.starts_with("VmRSS:")) {
+      return std::stol(line.substr(6));
+    }
+  }
+  return 0;
+}
+
+/**
+ * Imports the parking spaces into a copy of the base tiles in a child process.
+ */
+run_result run_import(const boost::property_tree::ptree& base_conf,
+                      const std::string& base_dir,
+                      const std::string& run_dir,
+                      const std::string& pbf,
+                      size_t threads) {
+  std::filesystem::remove_all(run_dir);
+  std::filesystem::copy(base_dir, run_dir, std::filesystem::copy_options::recursive);
+
+  auto conf = base_conf;
+  conf.put("mjolnir.tile_dir", run_dir);
+  conf.put("mjolnir.concurrency", threads);
+
+  // the child reports its RSS at the fork, which its peak RSS includes
+  int rss_pipe[2];
+  if (pipe(rss_pipe) != 0) {
+    throw std::runtime_error("Failed to create a pipe to the import process");
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto pid = fork();
+  if (pid < 0) {
+    throw std::runtime_error("Failed to fork the import process");
+  }
+  if (pid == 0) {
+    close(rss_pipe[0]);
+    long rss_at_fork = current_rss_kb();
+    if (write(rss_pipe[1], &rss_at_fork, sizeof(rss_at_fork)) != sizeof(rss_at_fork)) {
+      _exit(EXIT_FAILURE);
+    }
+    close(rss_pipe[1]);
+    try {
+      parking_spaces::process_parking_spaces(conf, pbf);
+    } catch (const std::exception& e) {
+      std::cerr << "Import failed: " << e.what() << std::endl;
+      _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+  }
+
+  close(rss_pipe[1]);
+  long rss_at_fork = 0;
+  if (read(rss_pipe[0], &rss_at_fork, sizeof(rss_at_fork)) != sizeof(rss_at_fork)) {
+    rss_at_fork = 0;
+  }
+  close(rss_pipe[0]);
+
+  int status = 0;
+  rusage usage{};
+  wait4(pid, &status, 0, &usage);
+  auto end = std::chrono::steady_clock::now();
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    throw std::runtime_error(std::format("Import with {} thread(s) failed", threads));
+  }
+
+  std::filesystem::remove_all(run_dir);
+  return {std::chrono::duration<double>(end - start).count(),
+          std::max(usage.ru_maxrss - rss_at_fork, 0l)};
+}
+
+/**
+ * @return the average seconds it takes to parse the parking spaces, and how many were found
+ */
+std::pair<double, size_t> time_parse(const boost::property_tree::ptree& conf,
+                                     const std::string& pbf,
+                                     size_t runs) {
+  size_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t run = 0; run < runs; ++run) {
+    found = parking_spaces::read_parking_spaces(conf, {pbf}).size();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return {elapsed.count() / std::max<size_t>(runs, 1), found};
+}
+
+std::vector<size_t> parse_threads(const std::string& list) {
+  std::vector<size_t> threads;
+  std::stringstream stream(list);
+  for (std::string item; std::getline(stream, item, ',');) {
+    threads.push_back(std::max<size_t>(1, std::stoul(item)));
+  }
+  return threads;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  cxxopts::Options options("bench_parking_spaces",
+                           "Benchmark process_parking_spaces on a synthetic city");
+  auto add_opt = options.add_options();
+  add_opt("h,help", "Print this help message.");
+  add_opt("streets", "Number of streets in each direction of the grid",
+          cxxopts::value<size_t>()->default_value("20"));
+  add_opt("lots", "Number of parking lots", cxxopts::value<size_t>()->default_value("200"));
+  add_opt("spaces-per-lot", "Number of parking spaces per lot",
+          cxxopts::value<size_t>()->default_value("50"));
+  add_opt("levels", "Number of levels the spaces of a lot are spread over",
+          cxxopts::value<size_t>()->default_value("1"));
+  add_opt("block-size", "Distance between two streets in meters",
+          cxxopts::value<double>()->default_value("150"));
+  add_opt("area-lots", "Number of lots whose spaces are mapped as areas instead of nodes",
+          cxxopts::value<size_t>()->default_value("0"));
+  add_opt("parse-runs", "How often to parse the file with and without ways, 0 to skip it",
+          cxxopts::value<size_t>()->default_value("0"));
+  add_opt("threads", "Comma separated thread counts to run the import with",
+          cxxopts::value<std::string>()->default_value(
+              std::format("1,2,4,{}", std::thread::hardware_concurrency())));
+  add_opt("work-dir", "Where to build the graph",
+          cxxopts::value<std::string>()->default_value(PS_BUILD_DIR "/bench"));
+  add_opt("verbose", "Keep the log output of the graph build and the import");
+
+  auto result = options.parse(argc, argv);
+  if (result.count("help")) {
+    std::cout << options.help() << "\n";
+    return EXIT_SUCCESS;
+  }
+
+  city_options city;
+  city.streets = std::max<size_t>(2, result["streets"].as<size_t>());
+  city.lots = result["lots"].as<size_t>();
+  city.spaces_per_lot = result["spaces-per-lot"].as<size_t>();
+  city.levels = std::max<size_t>(1, result["levels"].as<size_t>());
+  city.block_size = result["block-size"].as<double>();
+  city.area_lots = std::min(city.lots, result["area-lots"].as<size_t>());
+
+  if (!result.count("verbose")) {
+    midgard::logging::Configure({{"type", ""}});
+  }
+
+  auto work_dir = result["work-dir"].as<std::string>();
+  auto base_dir = work_dir + "/base";
+  std::filesystem::remove_all(work_dir);
+  std::filesystem::create_directories(base_dir);
+
+  auto pbf = work_dir + "/city.pbf";
+  auto spaces = write_city(city, {7.5, 52.55}, pbf);
+
+  auto conf = test::make_config(base_dir);
+  auto build_start = std::chrono::steady_clock::now();
+  mjolnir::build_tile_set(conf, {pbf}, mjolnir::BuildStage::kInitialize,
+                          mjolnir::BuildStage::kTransit);
+  std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - build_start;
+
+  std::cout << std::format("{} streets, {} lots with {} spaces on {} level(s): {} spaces, {} lots "
+                           "mapped as areas\n",
+                           city.streets * 2, city.lots, city.spaces_per_lot, city.levels, spaces,
+                           city.area_lots);
+  std::cout << std::format("graph built in {:.2f}s\n\n", build_time.count());
+  std::cout << std::format("{:>8} {:>10} {:>12} {:>8} {:>10} {:>12}\n", "threads", "seconds",
+                           "spaces/s", "speedup", "efficiency", "peak RSS MB");
+
+  // speedup and efficiency are relative to the first run, assuming it scaled perfectly
+  double baseline = 0.;
+  for (auto threads : parse_threads(result["threads"].as<std::string>())) {
+    auto run = run_import(conf, base_dir, work_dir + "/run", pbf, threads);
+    if (baseline == 0.) {
+      baseline = run.seconds * threads;
+    }
+    double speedup = baseline / run.seconds;
+    std::cout << std::format("{:>8} {:>10.3f} {:>12.0f} {:>8.2f} {:>9.0f}% {:>12.1f}\n", threads,
+                             run.seconds, spaces / run.seconds, speedup,
+                             100. * speedup / threads, run.peak_rss_kb / 1024.);
+  }
+
+  // importing ways gives up stopping at the first way and reads the nodes a second time if there
+  // are parking ways, which is what this compares
+  if (auto runs = result["parse-runs"].as<size_t>()) {
+    std::cout << std::format("\n{:>8} {:>10} {:>12}\n", "ways", "seconds", "found");
+    for (bool ways : {false, true}) {
+      auto parse_conf = conf;
+      parse_conf.put("parking_spaces.ways", ways);
+      auto [seconds, found] = time_parse(parse_conf, pbf, runs);
+      std::cout << std::format("{:>8} {:>10.3f} {:>12}\n", ways, seconds, found);
+    }
+  }
+
+  std::filesystem::remove_all(work_dir);
+  return EXIT_SUCCESS;
+}
@@ -1,12 +1,28 @@
+#include "parking_spaces/correlation.h"
+#include "parking_spaces/parking_index.h"
 #include "parking_spaces/parking_spaces.h"
+#include "parking_spaces/tile_io.h"
 
 #include <valhalla/gurka.h>
 #include <valhalla/midgard/sequence.h>
+#include <valhalla/mjolnir/graphtilebuilder.h>
 #include <valhalla/mjolnir/util.h>
 #include <valhalla/test.h>
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <latch>
+#include <map>
+#include <mutex>
+#include <thread>
+
 #ifndef PS_ROOT
 #def PS_ROOT
 #endif
@@ -27,11 +43,13 @@ std::string point_ll_diff(midgard::PointLL& a, midgard::PointLL& b) {
                      b.lat(), b.lng(), a.Distance(b));
 }
 
-map buildtiles_parking(const nodelayout& layout,
-                       const ways& ways,
-                       const nodes& nodes,
-                       const relations& relations,
-                       const boost::property_tree::ptree& config) {
+map buildtiles_parking(
+    const nodelayout& layout,
+    const ways& ways,
+    const nodes& nodes,
+    const relations& relations,
+    const boost::property_tree::ptree& config,
+    const std::function<void(const boost::property_tree::ptree&)>& import_parking = {}) {
 
   map result{config, layout};
   auto workdir = config.get<std::string>("mjolnir.tile_dir");
@@ -54,12 +72,109 @@ map buildtiles_parking(const nodelayout& layout,
 
   mjolnir::build_tile_set(result.config, {pbf_filename}, mjolnir::BuildStage::kInitialize,
                           mjolnir::BuildStage::kTransit);
-  parking_spaces::process_parking_spaces(result.config, pbf_filename);
+  if (import_parking) {
+    import_parking(result.config);
+  } else {
+    parking_spaces::process_parking_spaces(result.config, pbf_filename);
+  }
   mjolnir::build_tile_set(result.config, {pbf_filename}, mjolnir::BuildStage::kHierarchy,
                           mjolnir::BuildStage::kValidate);
 
   return result;
 }
+
+std::map<std::string, std::string> read_graph_tiles(const std::string& tile_dir) {
+  std::map<std::string, std::string> tiles;
+  for (const auto& entry : std::filesystem::recursive_directory_iterator(tile_dir)) {
+    if (entry.path().extension() != ".gph") {
+      continue;
+    }
+    std::ifstream file(entry.path(), std::ios::binary);
+    tiles[std::filesystem::relative(entry.path(), tile_dir).string()] =
+        std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+  return tiles;
+}
+
+constexpr size_t kTarBlock = 512;
+
+/**
+ * Writes a ustar header block with the given type
+ */
+void write_tar_header(std::ofstream& out, const std::string& name, size_t size, char typeflag) {
+  std::array<char, kTarBlock> header{};
+  std::snprintf(header.data(), 100, "%s", name.c_str());
+  std::snprintf(header.data() + 100, 8, "%07o", 0644);
+  std::snprintf(header.data() + 108, 8, "%07o", 0);
+  std::snprintf(header.data() + 116, 8, "%07o", 0);
+  std::snprintf(header.data() + 124, 12, "%011zo", size);
+  std::snprintf(header.data() + 136, 12, "%011o", 0);
+  header[156] = typeflag;
+  std::memcpy(header.data() + 257, "ustar", 6);
+  std::memcpy(header.data() + 263, "00", 2);
+  std::fill_n(header.begin() + 148, 8, ' ');
+  unsigned int checksum = 0;
+  for (auto c : header) {
+    checksum += static_cast<unsigned char>(c);
+  }
+  std::snprintf(header.data() + 148, 8, "%06o", checksum);
+  out.write(header.data(), header.size());
+}
+
+/**
+ * Writes the tiles into a ustar archive like valhalla_build_extract does, leaving out the index.
+ * Names longer than a ustar header holds get a GNU long name record like GNU tar writes.
+ */
+void write_tile_extract(const std::map<std::string, std::string>& tiles, const std::string& path) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  const std::array<char, kTarBlock> zero{};
+  auto write_entry = [&](const std::string& name, const std::string& bytes, char typeflag) {
+    write_tar_header(out, name, bytes.size(), typeflag);
+    out.write(bytes.data(), bytes.size());
+    out.write(zero.data(), (kTarBlock - bytes.size() % kTarBlock) % kTarBlock);
+  };
+  for (const auto& [name, bytes] : tiles) {
+    if (name.size() >= 100) {
+      write_entry("././@LongLink", name + '\0', 'L');
+    }
+    write_entry(name, bytes, '0');
+  }
+  out.write(zero.data(), zero.size());
+  out.write(zero.data(), zero.size());
+}
+
+/**
+ * @return the entries of a ustar archive, checking the header checksums and the two empty blocks
+ *         it has to end with
+ */
+std::map<std::string, std::string> read_tile_extract(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  const std::string tar(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>{});
+  EXPECT_EQ(tar.size() % kTarBlock, 0);
+
+  std::map<std::string, std::string> entries;
+  size_t pos = 0;
+  while (pos + kTarBlock <= tar.size()) {
+    const std::string_view header(tar.data() + pos, kTarBlock);
+    if (header.find_first_not_of('\0') == std::string_view::npos) {
+      break;
+    }
+
+    const std::string name(header.substr(0, header.substr(0, 100).find('\0')));
+    unsigned int checksum = 0;
+    for (size_t i = 0; i < kTarBlock; ++i) {
+      checksum += i >= 148 && i < 156 ? ' ' : static_cast<unsigned char>(header[i]);
+    }
+    EXPECT_EQ(checksum, std::stoul(std::string(header.substr(148, 8)), nullptr, 8)) << name;
+
+    const auto size = std::stoul(std::string(header.substr(124, 12)), nullptr, 8);
+    entries[name] = tar.substr(pos + kTarBlock, size);
+    pos += kTarBlock + (size + kTarBlock - 1) / kTarBlock * kTarBlock;
+  }
+  EXPECT_EQ(tar.size() - pos, 2 * kTarBlock);
+  EXPECT_EQ(tar.find_first_not_of('\0', pos), std::string::npos);
+  return entries;
+}
 } // namespace
 
 TEST(StandAlone, parse_nodes_empty) {
@@ -154,6 +269,130 @@ TEST(StandAlone, parse_nodes_basic) {
   }
 }
 
+TEST(StandAlone, parse_multiple_files) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/parse_multiple_files";
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "2"}});
+
+  std::filesystem::create_directories(data_dir);
+
+  const std::string ascii_map = R"(
+      A--------B
+      | 1  2  3|
+      C--------D
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.54});
+  gurka::ways ways = {
+      {"AB", {{"highway", "residential"}}},
+  };
+
+  // both extracts contain parking space 2
+  const auto west = data_dir + "/west.pbf";
+  gurka::detail::build_pbf(layout, ways,
+                           {{"1", {{"amenity", "parking_space"}, {"osm_id", "12"}}},
+                            {"2", {{"amenity", "parking_space"}, {"osm_id", "13"}}}},
+                           {}, west);
+  const auto east = data_dir + "/east.pbf";
+  gurka::detail::build_pbf(layout, ways,
+                           {{"2", {{"amenity", "parking_space"}, {"osm_id", "13"}}},
+                            {"3", {{"amenity", "parking_space"}, {"osm_id", "14"}}}},
+                           {}, east);
+
+  auto spaces = parking_spaces::read_parking_spaces(conf, {west, east});
+  std::vector<uint64_t> ids;
+  for (const auto& space : spaces) {
+    ids.push_back(space.node.osmid_);
+  }
+  std::sort(ids.begin(), ids.end());
+  EXPECT_EQ(ids, (std::vector<uint64_t>{12, 13, 14}));
+}
+
+TEST(StandAlone, parse_within_coverage) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/parse_within_coverage";
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"}});
+
+  std::filesystem::create_directories(data_dir);
+
+  const std::string ascii_map = R"(
+      A--------B
+        1
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.54});
+  // a parking space far away from any tile of the graph
+  layout["2"] = midgard::PointLL(13.4, 52.5);
+  gurka::ways ways = {
+      {"AB", {{"highway", "residential"}}},
+  };
+  gurka::nodes nodes{
+      {"1", {{"amenity", "parking_space"}, {"osm_id", "12"}}},
+      {"2", {{"amenity", "parking_space"}, {"osm_id", "13"}}},
+  };
+
+  buildtiles_parking(layout, ways, nodes, {}, conf);
+
+  // the parking space outside the graph is dropped while parsing
+  midgard::sequence<parking_spaces::parking_space_node> seq(data_dir + "/parking_space.bin");
+  ASSERT_EQ(seq.size(), 1);
+  EXPECT_EQ((*seq.at(0)).node.osmid_, 12);
+}
+
+TEST(StandAlone, parse_ways) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/parse_ways";
+  std::filesystem::create_directories(data_dir);
+
+  const std::string ascii_map = R"(
+      A-------------------B
+        P--Q   X----Y  1
+        |  |
+        S--R
+      C-------------------D
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.54});
+  // the way ids overlap with the id of parking space 1
+  gurka::ways ways = {
+      {"AB", {{"highway", "residential"}}},
+      {"CD", {{"highway", "residential"}}},
+      {"PQRSP", {{"amenity", "parking_space"}, {"level", "1"}, {"osm_id", "12"}}},
+      {"XY", {{"amenity", "parking_space"}, {"osm_id", "13"}}},
+  };
+  gurka::nodes nodes{
+      {"1", {{"amenity", "parking_space"}, {"osm_id", "12"}}},
+  };
+  const auto pbf_file = data_dir + "/map.pbf";
+  gurka::detail::build_pbf(layout, ways, nodes, {}, pbf_file);
+
+  for (const auto& index_type : {"sparse_file_array", "dense_file_array", "flex_mem"}) {
+    auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"},
+                                             {"parking_spaces.location_index", index_type}});
+    auto spaces = parking_spaces::read_parking_spaces(conf, {pbf_file});
+    ASSERT_EQ(spaces.size(), 3) << index_type;
+    std::sort(spaces.begin(), spaces.end(), [](const auto& a, const auto& b) {
+      return parking_spaces::parking_space_key(a) < parking_spaces::parking_space_key(b);
+    });
+
+    EXPECT_EQ(spaces[0].node.osmid_, 12);
+    EXPECT_EQ(spaces[0].type, parking_spaces::osm_type::node);
+
+    // areas are represented by their centroid, lines by their middle
+    auto centroid = layout.at("P").PointAlongSegment(layout.at("R"));
+    EXPECT_EQ(spaces[1].node.osmid_, 12);
+    EXPECT_EQ(spaces[1].type, parking_spaces::osm_type::way);
+    EXPECT_EQ(spaces[1].level, 1.f);
+    EXPECT_LT(spaces[1].node.latlng().Distance(centroid), 0.5);
+
+    auto middle = layout.at("X").PointAlongSegment(layout.at("Y"));
+    EXPECT_EQ(spaces[2].node.osmid_, 13);
+    EXPECT_EQ(spaces[2].type, parking_spaces::osm_type::way);
+    EXPECT_LT(spaces[2].node.latlng().Distance(middle), 0.5);
+  }
+
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"},
+                                           {"parking_spaces.ways", "false"}});
+  EXPECT_EQ(parking_spaces::read_parking_spaces(conf, {pbf_file}).size(), 1);
+}
+
 TEST(StandAlone, parse_and_correlate_nodes_levels) {
 
   std::string data_dir = PS_BUILD_DIR "/test/data/parse_nodes_basic";
@@ -315,6 +554,1386 @@ TEST(StandAlone, parse_and_correlate_nodes_levels) {
   }
 }
 
+TEST(StandAlone, dry_run_geojson) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/dry_run";
+  const auto geojson = data_dir + "/projections.geojson";
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"},
+                                           {"parking_spaces.dry_run", "true"},
+                                           {"parking_spaces.geojson", geojson}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(data_dir);
+
+  const std::string ascii_map = R"(
+      A-a-----------------B
+      | 1                 |
+      C-------------------D
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.54});
+  gurka::ways ways = {
+      {"AaB", {{"highway", "residential"}}},
+      {"AC", {{"highway", "residential"}}},
+      {"CD", {{"highway", "residential"}}},
+      {"DB", {{"highway", "residential"}}},
+  };
+
+  gurka::nodes nodes{
+      {"1", {{"amenity", "parking_space"}, {"osm_id", "12"}}},
+  };
+
+  const auto pbf_file = data_dir + "/map.pbf";
+  gurka::detail::build_pbf(layout, ways, nodes, {}, pbf_file);
+  midgard::logging::Configure({{"type", ""}});
+  mjolnir::build_tile_set(conf, {pbf_file}, mjolnir::BuildStage::kInitialize,
+                          mjolnir::BuildStage::kTransit);
+  parking_spaces::process_parking_spaces(conf, pbf_file);
+
+  // the tiles must not have been touched
+  {
+    auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+    const auto& node = gurka::findNode(*reader, layout, "A");
+    EXPECT_EQ(reader->nodeinfo(node)->edge_count(), 2);
+  }
+
+  std::ifstream file(geojson);
+  std::string content{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+  ASSERT_FALSE(content.empty());
+  EXPECT_EQ(content.rfind(R"({"type":"FeatureCollection","features":[)", 0), 0);
+  EXPECT_NE(content.find(R"("kind":"parking","osm_id":12,"level":null,"failed":false)"),
+            std::string::npos);
+  EXPECT_NE(content.find(R"("kind":"projection","osm_id":12)"), std::string::npos);
+  EXPECT_NE(content.find(R"("modes":["auto","pedestrian"])"), std::string::npos);
+  EXPECT_NE(content.find(R"("kind":"connection","osm_id":12)"), std::string::npos);
+}
+
+TEST(StandAlone, bicycle_parking) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/bicycle_parking";
+  auto conf = test::make_config(data_dir,
+                                {{"mjolnir.concurrency", "1"}, {"parking_spaces.type", "bicycle"}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(data_dir);
+
+  const std::string ascii_map = R"(
+      A-a-----------------B
+      | 1        2        |
+      |                   |
+      C-------------------D
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.54});
+  gurka::ways ways = {
+      {"AaB", {{"highway", "residential"}}},
+      {"AC", {{"highway", "residential"}}},
+      {"CD", {{"highway", "residential"}}},
+      {"DB", {{"highway", "residential"}}},
+  };
+
+  gurka::nodes nodes{
+      {"1", {{"amenity", "bicycle_parking"}, {"osm_id", "12"}}},
+      {"2", {{"amenity", "parking_space"}, {"osm_id", "13"}}},
+  };
+
+  buildtiles_parking(layout, ways, nodes, {}, conf);
+
+  // only the bicycle parking is picked up
+  midgard::sequence<parking_spaces::parking_space_node> seq(data_dir + "/parking_space.bin");
+  ASSERT_EQ(seq.size(), 1);
+  EXPECT_EQ((*seq.at(0)).node.osmid_, 12);
+
+  auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+  const auto& node = gurka::findNode(*reader, layout, "A");
+  auto niA = reader->nodeinfo(node);
+  ASSERT_EQ(niA->edge_count(), 3);
+
+  auto edge_id = node;
+  edge_id.set_id(niA->edge_index() + (niA->edge_count() - 1));
+  const auto* de = reader->directededge(edge_id);
+  EXPECT_EQ(de->forwardaccess(), baldr::kBicycleAccess | baldr::kPedestrianAccess);
+
+  auto ni1 = reader->nodeinfo(de->endnode());
+  EXPECT_EQ(ni1->type(), baldr::NodeType::kParking);
+  EXPECT_EQ(ni1->access(), baldr::kBicycleAccess | baldr::kPedestrianAccess);
+
+  // both directions of the connection share a single edge info
+  auto parking_edge_id = de->endnode();
+  size_t opposing = 0;
+  for (uint32_t i = 0; i < ni1->edge_count(); ++i) {
+    parking_edge_id.set_id(ni1->edge_index() + i);
+    const auto* parking_edge = reader->directededge(parking_edge_id);
+    if (parking_edge->endnode() == node) {
+      EXPECT_EQ(parking_edge->edgeinfo_offset(), de->edgeinfo_offset());
+      ++opposing;
+    }
+  }
+  EXPECT_EQ(opposing, 1);
+}
+
+TEST(StandAlone, motorcycle_parking) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/motorcycle_parking";
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"},
+                                           {"parking_spaces.type", "motorcycle"}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(data_dir);
+
+  const std::string ascii_map = R"(
+      A-a-----------------B
+      | 1        2       3|
+      |                   |
+      C-------------------D
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.54});
+  gurka::ways ways = {
+      {"AaB", {{"highway", "residential"}}},
+      {"AC", {{"highway", "residential"}}},
+      {"CD", {{"highway", "residential"}}},
+      {"DB", {{"highway", "residential"}}},
+  };
+
+  gurka::nodes nodes{
+      {"1", {{"amenity", "motorcycle_parking"}, {"osm_id", "12"}}},
+      {"2", {{"amenity", "parking_space"}, {"osm_id", "13"}}},
+      {"3", {{"amenity", "bicycle_parking"}, {"osm_id", "14"}}},
+  };
+
+  buildtiles_parking(layout, ways, nodes, {}, conf);
+
+  // only the motorcycle parking is picked up
+  midgard::sequence<parking_spaces::parking_space_node> seq(data_dir + "/parking_space.bin");
+  ASSERT_EQ(seq.size(), 1);
+  EXPECT_EQ((*seq.at(0)).node.osmid_, 12);
+
+  auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+  const auto& node = gurka::findNode(*reader, layout, "A");
+  auto niA = reader->nodeinfo(node);
+  ASSERT_EQ(niA->edge_count(), 3);
+
+  auto edge_id = node;
+  edge_id.set_id(niA->edge_index() + (niA->edge_count() - 1));
+  const auto* de = reader->directededge(edge_id);
+  EXPECT_TRUE(de->bss_connection());
+  EXPECT_EQ(de->forwardaccess(), baldr::kMotorcycleAccess | baldr::kPedestrianAccess);
+
+  auto ni1 = reader->nodeinfo(de->endnode());
+  EXPECT_EQ(ni1->type(), baldr::NodeType::kParking);
+  EXPECT_EQ(ni1->access(), baldr::kMotorcycleAccess | baldr::kPedestrianAccess);
+}
+
+TEST(StandAlone, parking_index) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/parking_index";
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"}});
+
+  std::filesystem::create_directories(data_dir);
+
+  const std::string ascii_map = R"(
+      A-------------------B
+      | 1      2        3 |
+      C-------------------D
+      E-------------------F
+            4
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.54});
+  gurka::ways ways = {
+      {"AB", {{"highway", "residential"}}},
+      {"AC", {{"highway", "residential"}}},
+      {"CD", {{"highway", "residential"}}},
+      {"DB", {{"highway", "residential"}}},
+      {"EF", {{"highway", "residential"}, {"level", "1"}}},
+  };
+
+  gurka::nodes nodes{
+      {"1", {{"amenity", "parking_space"}, {"osm_id", "12"}}},
+      {"2", {{"amenity", "parking_space"}, {"osm_id", "13"}}},
+      {"3", {{"amenity", "parking_space"}, {"osm_id", "14"}}},
+      {"4", {{"amenity", "parking_space"}, {"level", "1"}, {"osm_id", "15"}}},
+  };
+
+  buildtiles_parking(layout, ways, nodes, {}, conf);
+
+  parking_spaces::parking_index index(data_dir + "/parking_index.bin");
+  ASSERT_EQ(index.size(), 4);
+
+  auto osm_ids = [](const std::vector<parking_spaces::parking_index::result>& results) {
+    std::vector<uint64_t> ids;
+    for (const auto& result : results) {
+      ids.push_back(result.entry->osm_id);
+    }
+    return ids;
+  };
+
+  // 4 is 50m away from 1 and 2 is 70m away
+  auto nearest = index.nearest(layout.at("1"), 3);
+  EXPECT_EQ(osm_ids(nearest), (std::vector<uint64_t>{12, 15, 13}));
+  EXPECT_NEAR(nearest[0].distance, 0.f, 1.f);
+  EXPECT_NEAR(nearest[1].distance, 50.f, 1.f);
+
+  EXPECT_EQ(osm_ids(index.nearest(layout.at("1"), 3, 1.f)), std::vector<uint64_t>{15});
+  EXPECT_EQ(osm_ids(index.nearest(layout.at("1"), 3, parking_spaces::kInvalidLevel, 60.f)),
+            (std::vector<uint64_t>{12, 15}));
+
+  // the entries point to the parking nodes in the graph and the way nodes they connect to
+  auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+  const auto& entry = *index.nearest(layout.at("4"), 1).front().entry;
+  EXPECT_EQ(entry.level, 1.f);
+  EXPECT_EQ(reader->nodeinfo(baldr::GraphId(entry.node_id))->type(), baldr::NodeType::kParking);
+
+  auto way_nodes = index.way_nodes(entry);
+  std::sort(way_nodes.begin(), way_nodes.end());
+  std::vector<baldr::GraphId> expected{gurka::findNode(*reader, layout, "E"),
+                                       gurka::findNode(*reader, layout, "F")};
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(way_nodes, expected);
+}
+
+TEST(StandAlone, correlate_in_memory) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/correlate_in_memory";
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"},
+                                           {"parking_spaces.search_radius", "20"}});
+
+  std::filesystem::create_directories(data_dir);
+
+  const std::string ascii_map = R"(
+      A-------------------B
+         1
+
+                    2
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.54});
+  gurka::ways ways = {
+      {"AB", {{"highway", "residential"}}},
+  };
+
+  // 2 is 30m away from the road
+  std::vector<parking_spaces::parking_space_node> spaces(2);
+  for (auto [i, name] : {std::pair{0, "1"}, std::pair{1, "2"}}) {
+    spaces[i].node = OSMNode{static_cast<uint64_t>(12 + i)};
+    spaces[i].node.set_latlng(layout.at(name).lng(), layout.at(name).lat());
+    spaces[i].level = parking_spaces::kInvalidLevel;
+    spaces[i].level_precision = 0.f;
+  }
+  // and so is a parking space mapped as a way, whose id is the same as the node's
+  spaces.push_back(spaces[1]);
+  spaces[2].type = parking_spaces::osm_type::way;
+
+  parking_spaces::correlation_result result;
+  buildtiles_parking(layout, ways, {}, {}, conf, [&](const boost::property_tree::ptree& config) {
+    result = parking_spaces::correlate_parking_spaces(config, spaces);
+  });
+
+  ASSERT_EQ(result.tiles.size(), 1);
+  EXPECT_EQ(result.tiles[0].tile_id,
+            baldr::TileHierarchy::GetGraphId(layout.at("1"),
+                                             baldr::TileHierarchy::levels().back().level));
+  EXPECT_EQ(result.tiles[0].parking_spaces, 3);
+  EXPECT_EQ(result.tiles[0].parking_nodes, 1);
+  EXPECT_GT(result.tiles[0].connections, 0);
+  // the temporaries of such a small tile fit into the initial block of the arena
+  EXPECT_GT(result.tiles[0].arena_allocations, 0);
+  EXPECT_EQ(result.tiles[0].heap_allocations, 0);
+  EXPECT_EQ(result.failed, (std::vector<uint64_t>{parking_spaces::parking_space_key(spaces[1]),
+                                                   parking_spaces::parking_space_key(spaces[2])}));
+  EXPECT_NE(result.failed[0], result.failed[1]);
+  EXPECT_EQ(result.outside, 0);
+
+  // nothing went through the parse output
+  EXPECT_FALSE(std::filesystem::exists(data_dir + "/parking_space.bin"));
+  EXPECT_EQ(parking_spaces::parking_index(data_dir + "/parking_index.bin").size(), 1);
+}
+
+TEST(StandAlone, remove_and_reimport) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/remove_and_reimport";
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "2"}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(data_dir);
+
+  const std::string ascii_map = R"(
+      A-----B-----C
+      |1 2  |3  4 |
+      D-----E-----F
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.4998, 52.5002});
+  gurka::ways ways = {
+      {"ABC", {{"highway", "residential"}}},
+      {"DEF", {{"highway", "residential"}}},
+      {"AD", {{"highway", "residential"}}},
+      {"BE", {{"highway", "residential"}}},
+      {"CF", {{"highway", "residential"}}},
+  };
+  gurka::nodes nodes;
+  for (char name = '1'; name <= '4'; ++name) {
+    nodes[std::string(1, name)] = {{"amenity", "parking_space"},
+                                   {"osm_id", std::to_string(100 + name - '0')}};
+  }
+
+  const auto pbf_file = data_dir + "/map.pbf";
+  gurka::detail::build_pbf(layout, ways, nodes, {}, pbf_file);
+  midgard::logging::Configure({{"type", ""}});
+  mjolnir::build_tile_set(conf, {pbf_file}, mjolnir::BuildStage::kInitialize,
+                          mjolnir::BuildStage::kTransit);
+
+  // the number of nodes and edges in each tile
+  auto graph_counts = [&]() {
+    std::map<uint32_t, std::pair<uint32_t, uint32_t>> counts;
+    auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+    for (const auto& tile_id : reader->GetTileSet(2)) {
+      auto tile = reader->GetGraphTile(tile_id);
+      counts[tile_id.tileid()] = {tile->header()->nodecount(), tile->header()->directededgecount()};
+    }
+    return counts;
+  };
+  const auto base = graph_counts();
+
+  // stripping leaves the tiles as a tile builder stores them after reading them, which may lay
+  // out the edge infos differently than the graph build did
+  const auto round_trip_dir = data_dir + "_round_trip";
+  std::filesystem::remove_all(round_trip_dir);
+  std::filesystem::copy(data_dir, round_trip_dir, std::filesystem::copy_options::recursive);
+  {
+    auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+    for (const auto& tile_id : reader->GetTileSet(2)) {
+      GraphTileBuilder builder(round_trip_dir, tile_id, true);
+      builder.StoreTileData();
+    }
+  }
+  const auto base_tiles = read_graph_tiles(round_trip_dir);
+
+  parking_spaces::process_parking_spaces(conf, pbf_file);
+  const auto imported = graph_counts();
+  ASSERT_NE(imported, base);
+
+  EXPECT_EQ(parking_spaces::remove_parking_spaces(conf), nodes.size());
+  EXPECT_EQ(graph_counts(), base);
+  auto stripped_tiles = read_graph_tiles(data_dir);
+  ASSERT_EQ(stripped_tiles.size(), base_tiles.size());
+  for (const auto& [name, bytes] : base_tiles) {
+    EXPECT_TRUE(stripped_tiles[name] == bytes) << name << " differs after stripping";
+  }
+  EXPECT_EQ(parking_spaces::remove_parking_spaces(conf), 0);
+
+  // reimporting any number of times gives the same graph as importing once
+  auto reimport_conf = conf;
+  reimport_conf.put("parking_spaces.reimport", true);
+  parking_spaces::process_parking_spaces(reimport_conf, pbf_file);
+  EXPECT_EQ(graph_counts(), imported);
+  parking_spaces::process_parking_spaces(reimport_conf, pbf_file);
+  EXPECT_EQ(graph_counts(), imported);
+
+  // a shard must not strip the tiles of the others
+  const auto reimported_tiles = read_graph_tiles(data_dir);
+  reimport_conf.put("parking_spaces.shard", "1/2");
+  EXPECT_THROW(parking_spaces::process_parking_spaces(reimport_conf, pbf_file),
+               std::runtime_error);
+  EXPECT_TRUE(read_graph_tiles(data_dir) == reimported_tiles);
+
+  auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+  for (const auto& name : {"A", "B", "C"}) {
+    auto node_id = gurka::findNode(*reader, layout, name);
+    const auto* node = reader->nodeinfo(node_id);
+    for (uint32_t i = 0; i < node->edge_count(); ++i) {
+      auto edge_id = node_id;
+      edge_id.set_id(node->edge_index() + i);
+      const auto* edge = reader->directededge(edge_id);
+      EXPECT_NE(reader->nodeinfo(edge->endnode()), nullptr) << name;
+    }
+  }
+}
+
+TEST(StandAlone, search_radius) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/search_radius";
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"},
+                                           {"parking_spaces.search_radius", "100"}});
+
+  std::filesystem::create_directories(data_dir);
+
+  // the tile border at 52.5 runs between AB and parking space 1, parking space 2 is more than
+  // 100m away from both roads
+  const std::string ascii_map = R"(
+      A-------------------B
+
+
+
+      1
+
+
+
+
+
+
+
+
+
+      2
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+      C-------------------D
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.5002});
+  gurka::ways ways = {
+      {"AB", {{"highway", "residential"}}},
+      {"CD", {{"highway", "residential"}}},
+  };
+
+  gurka::nodes nodes{
+      {"1", {{"amenity", "parking_space"}, {"osm_id", "12"}}},
+      {"2", {{"amenity", "parking_space"}, {"osm_id", "13"}}},
+  };
+
+  const auto& tiles = baldr::TileHierarchy::levels().back().tiles;
+  ASSERT_NE(tiles.TileId(layout.at("A")), tiles.TileId(layout.at("1")));
+  ASSERT_EQ(tiles.TileId(layout.at("C")), tiles.TileId(layout.at("1")));
+
+  buildtiles_parking(layout, ways, nodes, {}, conf);
+
+  auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+
+  // parking space 1 connects to the road in the neighbouring tile rather than to CD
+  {
+    const auto& node = gurka::findNode(*reader, layout, "A");
+    auto niA = reader->nodeinfo(node);
+    ASSERT_EQ(niA->edge_count(), 2);
+
+    auto edge_id = node;
+    edge_id.set_id(niA->edge_index() + (niA->edge_count() - 1));
+    const auto* de = reader->directededge(edge_id);
+    EXPECT_EQ(reader->nodeinfo(de->endnode())->type(), baldr::NodeType::kParking);
+    EXPECT_NE(de->endnode().tileid(), node.tileid());
+  }
+
+  // parking space 2 is dropped instead of being connected to the least bad edge
+  EXPECT_EQ(reader->nodeinfo(gurka::findNode(*reader, layout, "C"))->edge_count(), 1);
+  EXPECT_EQ(reader->nodeinfo(gurka::findNode(*reader, layout, "D"))->edge_count(), 1);
+}
+
+TEST(StandAlone, tile_cache) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/tile_cache";
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"}});
+
+  std::filesystem::create_directories(data_dir);
+
+  // A and B lie in two different tiles
+  const std::string ascii_map = R"(
+      A-------------------B
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.4995, 52.54});
+  gurka::ways ways = {
+      {"AB", {{"highway", "residential"}}},
+  };
+  buildtiles_parking(layout, ways, {}, {}, conf);
+
+  auto level = baldr::TileHierarchy::levels().back().level;
+  auto tile_a = baldr::TileHierarchy::GetGraphId(layout.at("A"), level);
+  auto tile_b = baldr::TileHierarchy::GetGraphId(layout.at("B"), level);
+  ASSERT_NE(tile_a, tile_b);
+
+  std::mutex lock;
+  {
+    // all threads get the same tile, which is only read once
+    parking_spaces::tile_cache cache(conf.get_child("mjolnir"), lock, 1ul << 30);
+    std::vector<baldr::graph_tile_ptr> tiles(8);
+    std::vector<std::thread> threads;
+    for (auto& tile : tiles) {
+      threads.emplace_back([&cache, &tile, &tile_a]() { tile = cache.get(tile_a); });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    ASSERT_TRUE(tiles.front());
+    for (const auto& tile : tiles) {
+      EXPECT_EQ(tile, tiles.front());
+    }
+    EXPECT_EQ(cache.stats().misses, 1);
+    EXPECT_EQ(cache.stats().hits, 7);
+
+    // tiles that do not exist are remembered as well
+    auto nowhere = baldr::TileHierarchy::GetGraphId({-100.f, -50.f}, level);
+    EXPECT_FALSE(cache.get(nowhere));
+    EXPECT_FALSE(cache.get(nowhere));
+    EXPECT_EQ(cache.stats().misses, 2);
+  }
+
+  {
+    // with a budget smaller than a tile only the last tile read stays cached
+    parking_spaces::tile_cache cache(conf.get_child("mjolnir"), lock, 1);
+    auto first = cache.get(tile_a);
+    auto second = cache.get(tile_b);
+    ASSERT_TRUE(first && second);
+    EXPECT_EQ(cache.stats().evictions, 1);
+    EXPECT_EQ(cache.stats().bytes, second->header()->end_offset());
+
+    // the evicted tile stays valid for as long as it is held
+    EXPECT_EQ(first->id(), tile_a);
+    EXPECT_NE(cache.get(tile_a), first);
+    EXPECT_EQ(cache.stats().misses, 3);
+  }
+}
+
+TEST(StandAlone, tile_schedule) {
+
+  // a block of 16 x 16 local tiles, aligned so the Hilbert curve runs through it in one piece
+  const auto& level = baldr::TileHierarchy::levels().back();
+  const auto columns = static_cast<uint32_t>(level.tiles.ncolumns());
+  std::vector<baldr::GraphId> tiles;
+  for (uint32_t row = 304; row < 320; ++row) {
+    for (uint32_t col = 704; col < 720; ++col) {
+      tiles.emplace_back(row * columns + col, level.level, 0);
+    }
+  }
+
+  // a single worker walks the curve, from every tile to one next to it
+  parking_spaces::tile_schedule single(tiles, 1);
+  auto previous = single.next(0);
+  ASSERT_TRUE(previous);
+  size_t handed_out = 1;
+  while (auto tile_id = single.next(0)) {
+    auto col = [columns](const baldr::GraphId& id) { return int64_t(id.tileid() % columns); };
+    auto row = [columns](const baldr::GraphId& id) { return int64_t(id.tileid() / columns); };
+    EXPECT_EQ(std::abs(col(*tile_id) - col(*previous)) + std::abs(row(*tile_id) - row(*previous)),
+              1);
+    previous = tile_id;
+    ++handed_out;
+  }
+  EXPECT_EQ(handed_out, tiles.size());
+
+  // workers that are done steal from the others, every tile is handed out exactly once
+  parking_spaces::tile_schedule shared(tiles, 4);
+  std::vector<std::vector<baldr::GraphId>> taken(4);
+  std::vector<std::thread> threads;
+  // the first worker is stuck on its first tile until the others found nothing left to steal
+  std::latch drained(taken.size() - 1);
+  for (size_t worker = 0; worker < taken.size(); ++worker) {
+    threads.emplace_back([&shared, &taken, &drained, worker]() {
+      while (auto tile_id = shared.next(worker)) {
+        taken[worker].push_back(*tile_id);
+        if (worker == 0) {
+          drained.wait();
+        }
+      }
+      if (worker != 0) {
+        drained.count_down();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::vector<baldr::GraphId> all;
+  for (const auto& worker_tiles : taken) {
+    all.insert(all.end(), worker_tiles.begin(), worker_tiles.end());
+  }
+  std::sort(all.begin(), all.end());
+  std::sort(tiles.begin(), tiles.end());
+  EXPECT_EQ(all, tiles);
+  EXPECT_EQ(taken[0].size(), 1);
+  for (size_t worker = 1; worker < taken.size(); ++worker) {
+    EXPECT_FALSE(taken[worker].empty()) << worker;
+  }
+}
+
+TEST(StandAlone, truncate_shape) {
+
+  const std::string ascii_map = R"(
+      A-b-c-d-e---f-g-B
+                1
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.54});
+  gurka::ways ways = {
+      {"AbcdefgB", {{"highway", "residential"}}},
+  };
+  gurka::nodes nodes{
+      {"1", {{"amenity", "parking_space"}, {"osm_id", "12"}}},
+  };
+
+  // the connection edge from A to the parking space
+  auto connection_edge = [&](const std::string& name, bool truncate) {
+    std::string data_dir = PS_BUILD_DIR "/test/data/truncate_shape_" + name;
+    auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"},
+                                             {"parking_spaces.truncate_shape",
+                                              truncate ? "true" : "false"}});
+    std::filesystem::create_directories(data_dir);
+    buildtiles_parking(layout, ways, nodes, {}, conf);
+
+    auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+    auto edge_id = gurka::findNode(*reader, layout, "A");
+    auto niA = reader->nodeinfo(edge_id);
+    edge_id.set_id(niA->edge_index() + (niA->edge_count() - 1));
+    baldr::graph_tile_ptr tile;
+    const auto* de = reader->directededge(edge_id, tile);
+    EXPECT_TRUE(de->bss_connection());
+    return std::make_pair(de->length(), tile->edgeinfo(de).shape().size());
+  };
+
+  auto [full_length, full_points] = connection_edge("full", false);
+  auto [truncated_length, truncated_points] = connection_edge("truncated", true);
+
+  // A, b, c, d, e, the projected point and the parking space, of which only A, e, the projected
+  // point and the parking space are left
+  EXPECT_EQ(full_points, 7);
+  EXPECT_EQ(truncated_points, 4);
+  EXPECT_EQ(truncated_length, full_length);
+}
+
+TEST(StandAlone, shape_tolerance) {
+
+  // the road climbs to k and comes down again to e in straight lines, then runs straight to B
+  gurka::nodelayout layout;
+  layout["A"] = midgard::PointLL(7.5000, 52.5400);
+  layout["b"] = midgard::PointLL(7.5001, 52.5401);
+  layout["k"] = midgard::PointLL(7.5002, 52.5402);
+  layout["d"] = midgard::PointLL(7.5003, 52.5401);
+  layout["e"] = midgard::PointLL(7.5004, 52.5400);
+  layout["f"] = midgard::PointLL(7.5006, 52.5400);
+  layout["g"] = midgard::PointLL(7.5008, 52.5400);
+  layout["B"] = midgard::PointLL(7.5010, 52.5400);
+  layout["1"] = midgard::PointLL(7.5009, 52.5399);
+  gurka::ways ways = {
+      {"AbkdefgB", {{"highway", "residential"}}},
+  };
+  gurka::nodes nodes{
+      {"1", {{"amenity", "parking_space"}, {"osm_id", "12"}}},
+  };
+
+  // the shape of the connection edge from A to the parking space, from A on
+  auto connection_edge = [&](const std::string& name, const std::string& tolerance) {
+    std::string data_dir = PS_BUILD_DIR "/test/data/shape_tolerance_" + name;
+    auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"},
+                                             {"parking_spaces.shape_tolerance", tolerance}});
+    std::filesystem::create_directories(data_dir);
+    buildtiles_parking(layout, ways, nodes, {}, conf);
+
+    auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+    auto edge_id = gurka::findNode(*reader, layout, "A");
+    auto niA = reader->nodeinfo(edge_id);
+    edge_id.set_id(niA->edge_index() + (niA->edge_count() - 1));
+    baldr::graph_tile_ptr tile;
+    const auto* de = reader->directededge(edge_id, tile);
+    EXPECT_TRUE(de->bss_connection());
+    auto shape = tile->edgeinfo(de).shape();
+    if (!de->forward()) {
+      std::reverse(shape.begin(), shape.end());
+    }
+    return std::make_pair(de->length(), shape);
+  };
+
+  auto [full_length, full_shape] = connection_edge("full", "0");
+  auto [reduced_length, reduced_shape] = connection_edge("reduced", "1");
+
+  // the points on the straight stretches go, the corners, the projected point and the parking
+  // space stay
+  ASSERT_EQ(full_shape.size(), 9);
+  const std::vector<midgard::PointLL> expected = {layout["A"], layout["k"], layout["e"],
+                                                  midgard::PointLL(7.5009, 52.5400), layout["1"]};
+  ASSERT_EQ(reduced_shape.size(), expected.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_NEAR(reduced_shape[i].lng(), expected[i].lng(), 1e-6) << i;
+    EXPECT_NEAR(reduced_shape[i].lat(), expected[i].lat(), 1e-6) << i;
+  }
+  EXPECT_EQ(reduced_length, full_length);
+}
+
+TEST(StandAlone, tile_patcher) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/tile_patcher";
+  std::string tile_dir = data_dir + "/tiles";
+  auto conf = test::make_config(tile_dir, {{"mjolnir.concurrency", "1"}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(tile_dir);
+
+  const std::string ascii_map = R"(
+      A-------------------B
+        1
+
+        2
+      C-------------------D
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.5, 52.54});
+  gurka::ways ways = {
+      {"AB", {{"highway", "residential"}}},
+      {"CD", {{"highway", "residential"}}},
+  };
+
+  const auto pbf_file = data_dir + "/map.pbf";
+  gurka::detail::build_pbf(layout, ways, {}, {}, pbf_file);
+  midgard::logging::Configure({{"type", ""}});
+  mjolnir::build_tile_set(conf, {pbf_file}, mjolnir::BuildStage::kInitialize,
+                          mjolnir::BuildStage::kTransit);
+
+  parking_spaces::tile_patcher patcher(conf, data_dir + "/pristine");
+
+  auto change = [&](parking_spaces::parking_change::action action, const std::string& name,
+                    parking_spaces::osm_type type = parking_spaces::osm_type::node) {
+    parking_spaces::parking_change change{action, {}};
+    change.space.node = valhalla::mjolnir::OSMNode{12};
+    change.space.type = type;
+    change.space.node.set_latlng(layout.at(name).lng(), layout.at(name).lat());
+    change.space.level = parking_spaces::kInvalidLevel;
+    return patcher.apply({change});
+  };
+  auto edge_count = [&](const std::string& name) {
+    auto reader = test::make_clean_graphreader(conf.get_child("mjolnir"));
+    return reader->nodeinfo(gurka::findNode(*reader, layout, name))->edge_count();
+  };
+
+  auto added = change(parking_spaces::parking_change::action::add, "1");
+  EXPECT_GT(added.tiles, 0);
+  EXPECT_TRUE(added.failed.empty());
+  EXPECT_EQ(patcher.size(), 1);
+  EXPECT_EQ(edge_count("A"), 2);
+  EXPECT_EQ(edge_count("C"), 1);
+
+  // moving the parking space connects it to CD instead, without leftovers on AB
+  change(parking_spaces::parking_change::action::move, "2");
+  EXPECT_EQ(patcher.size(), 1);
+  EXPECT_EQ(edge_count("A"), 1);
+  EXPECT_EQ(edge_count("C"), 2);
+
+  // the parking index follows the move
+  parking_spaces::parking_index index(tile_dir + "/parking_index.bin");
+  auto nearest = index.nearest(layout.at("2"), 1);
+  ASSERT_EQ(nearest.size(), 1);
+  EXPECT_EQ(nearest.front().entry->osm_id, 12);
+  EXPECT_NEAR(nearest.front().distance, 0.f, 1.f);
+
+  change(parking_spaces::parking_change::action::remove, "2");
+  EXPECT_EQ(patcher.size(), 0);
+  EXPECT_EQ(edge_count("A"), 1);
+  EXPECT_EQ(edge_count("C"), 1);
+
+  // unknown parking spaces cannot be removed
+  auto rejected = change(parking_spaces::parking_change::action::remove, "2");
+  EXPECT_EQ(rejected.rejected, std::vector<uint64_t>{12});
+
+  // a way with the same id is a parking space of its own
+  const auto way = parking_spaces::osm_type::way;
+  auto added_way = change(parking_spaces::parking_change::action::add, "1", way);
+  EXPECT_TRUE(added_way.failed.empty());
+  EXPECT_EQ(patcher.size(), 1);
+  EXPECT_EQ(edge_count("A"), 2);
+  rejected = change(parking_spaces::parking_change::action::remove, "1");
+  EXPECT_EQ(rejected.rejected, std::vector<uint64_t>{12});
+  EXPECT_EQ(patcher.size(), 1);
+
+  change(parking_spaces::parking_change::action::remove, "1", way);
+  EXPECT_EQ(patcher.size(), 0);
+  EXPECT_EQ(edge_count("A"), 1);
+  rejected = change(parking_spaces::parking_change::action::remove, "1", way);
+  ASSERT_EQ(rejected.rejected.size(), 1);
+  EXPECT_EQ(parking_spaces::split_parking_space_key(rejected.rejected[0]),
+            std::make_pair(uint64_t(12), way));
+}
+
+TEST(StandAlone, deterministic_output) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/deterministic_output";
+  std::string base_dir = data_dir + "/base";
+  auto conf = test::make_config(base_dir, {{"mjolnir.concurrency", "1"}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(base_dir);
+
+  // the map spans four tiles, with several parking spaces connecting to the same way nodes from
+  // different tiles
+  const std::string ascii_map = R"(
+      A-----B-----C
+      |1 2  |3  4 |
+      | 5   |  6  |
+      D-----E-----F
+      |7   8| 9   |
+      G-----H-----I
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.4998, 52.5002});
+  gurka::ways ways = {
+      {"ABC", {{"highway", "residential"}}}, {"DEF", {{"highway", "residential"}}},
+      {"GHI", {{"highway", "residential"}}}, {"ADG", {{"highway", "residential"}}},
+      {"BEH", {{"highway", "residential"}}}, {"CFI", {{"highway", "residential"}}},
+  };
+
+  gurka::nodes nodes;
+  for (char name = '1'; name <= '9'; ++name) {
+    nodes[std::string(1, name)] = {{"amenity", "parking_space"},
+                                   {"osm_id", std::to_string(100 + name - '0')}};
+  }
+
+  const auto pbf_file = base_dir + "/map.pbf";
+  gurka::detail::build_pbf(layout, ways, nodes, {}, pbf_file);
+  midgard::logging::Configure({{"type", ""}});
+  mjolnir::build_tile_set(conf, {pbf_file}, mjolnir::BuildStage::kInitialize,
+                          mjolnir::BuildStage::kTransit);
+  const auto base_tiles = read_graph_tiles(base_dir);
+  ASSERT_GT(base_tiles.size(), 1);
+
+  // the last runs also cut the tiles into chunks projected by several workers
+  const std::vector<std::pair<int, int>> runs = {{1, 1024}, {2, 1024}, {4, 1024},
+                                                 {8, 1024}, {1, 2},    {4, 1}};
+  std::map<std::string, std::string> expected;
+  for (auto [threads, chunk_size] : runs) {
+    auto run_dir = std::format("{}/threads_{}_chunks_{}", data_dir, threads, chunk_size);
+    std::filesystem::copy(base_dir, run_dir, std::filesystem::copy_options::recursive);
+
+    auto run_conf = conf;
+    run_conf.put("mjolnir.tile_dir", run_dir);
+    run_conf.put("mjolnir.concurrency", threads);
+    run_conf.put("parking_spaces.projection_chunk_size", chunk_size);
+    parking_spaces::process_parking_spaces(run_conf, pbf_file);
+
+    auto tiles = read_graph_tiles(run_dir);
+    if (expected.empty()) {
+      ASSERT_NE(tiles, base_tiles);
+      expected = std::move(tiles);
+      continue;
+    }
+
+    ASSERT_EQ(tiles.size(), expected.size());
+    for (const auto& [name, bytes] : expected) {
+      EXPECT_TRUE(tiles[name] == bytes)
+          << name << " differs with " << threads << " threads and chunks of " << chunk_size;
+    }
+  }
+}
+
+TEST(StandAlone, projection_cache) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/projection_cache";
+  std::string base_dir = data_dir + "/base";
+  std::string cache_dir = data_dir + "/projections";
+  auto conf = test::make_config(base_dir, {{"mjolnir.concurrency", "2"},
+                                           {"parking_spaces.search_radius", "20"},
+                                           {"parking_spaces.projection_cache", cache_dir}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(base_dir);
+
+  // the map spans four tiles, 5 is too far from the roads to be connected
+  const std::string ascii_map = R"(
+      A-----B-----C
+      |1    |3    |
+      |     |     |
+      |     |  5  |
+      |     |     |
+      |     |     |
+      D-----E-----F
+      |7    |9    |
+      G-----H-----I
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.4998, 52.5002});
+  gurka::ways ways = {
+      {"ABC", {{"highway", "residential"}}}, {"DEF", {{"highway", "residential"}}},
+      {"GHI", {{"highway", "residential"}}}, {"ADG", {{"highway", "residential"}}},
+      {"BEH", {{"highway", "residential"}}}, {"CFI", {{"highway", "residential"}}},
+  };
+  gurka::nodes nodes;
+  for (std::string name : {"1", "3", "5", "7", "9"}) {
+    nodes[name] = {{"amenity", "parking_space"}, {"osm_id", "10" + name}};
+  }
+
+  const auto pbf_file = base_dir + "/map.pbf";
+  gurka::detail::build_pbf(layout, ways, nodes, {}, pbf_file);
+  midgard::logging::Configure({{"type", ""}});
+  mjolnir::build_tile_set(conf, {pbf_file}, mjolnir::BuildStage::kInitialize,
+                          mjolnir::BuildStage::kTransit);
+  auto spaces = parking_spaces::read_parking_spaces(conf, {pbf_file});
+  ASSERT_EQ(spaces.size(), nodes.size());
+
+  auto run_import = [&](const std::string& name) {
+    auto run_dir = data_dir + "/" + name;
+    std::filesystem::copy(base_dir, run_dir, std::filesystem::copy_options::recursive);
+    auto run_conf = conf;
+    run_conf.put("mjolnir.tile_dir", run_dir);
+    auto result = parking_spaces::correlate_parking_spaces(run_conf, spaces);
+    return std::make_pair(result, read_graph_tiles(run_dir));
+  };
+
+  // the first import fills the cache
+  auto [first, first_tiles] = run_import("first");
+  ASSERT_GT(first.tiles.size(), 1);
+  for (const auto& tile : first.tiles) {
+    EXPECT_FALSE(tile.cached);
+  }
+  EXPECT_EQ(first.failed, std::vector<uint64_t>{105});
+
+  // the second one takes every projection from it and writes the same tiles
+  auto [second, second_tiles] = run_import("second");
+  ASSERT_EQ(second.tiles.size(), first.tiles.size());
+  for (const auto& tile : second.tiles) {
+    EXPECT_TRUE(tile.cached);
+  }
+  EXPECT_EQ(second.failed, first.failed);
+  ASSERT_EQ(second_tiles.size(), first_tiles.size());
+  for (const auto& [name, bytes] : first_tiles) {
+    EXPECT_TRUE(second_tiles[name] == bytes) << name << " differs with cached projections";
+  }
+
+  // moving a parking space only projects its own tile again
+  auto moved = std::find_if(spaces.begin(), spaces.end(),
+                            [](const auto& space) { return space.node.osmid_ == 101; });
+  ASSERT_NE(moved, spaces.end());
+  moved->node.set_latlng(moved->node.latlng().lng() + 0.00001, moved->node.latlng().lat());
+  auto moved_tile =
+      baldr::TileHierarchy::GetGraphId(moved->node.latlng(),
+                                       baldr::TileHierarchy::levels().back().level);
+  auto third = run_import("third").first;
+  for (const auto& tile : third.tiles) {
+    EXPECT_EQ(tile.cached, tile.tile_id != moved_tile) << tile.tile_id.value;
+  }
+}
+
+TEST(StandAlone, projection_cache_neighbours) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/projection_cache_neighbours";
+  std::string cache_dir = data_dir + "/projections";
+  auto conf = test::make_config(data_dir, {{"mjolnir.concurrency", "1"},
+                                           {"parking_spaces.search_radius", "20"},
+                                           {"parking_spaces.projection_cache", cache_dir}});
+
+  std::filesystem::remove_all(data_dir);
+
+  // 1 is about 10m west of the tile boundary at 7.5 and 2 far east of it, 3 is in a tile far away
+  gurka::nodelayout layout;
+  layout["A"] = midgard::PointLL(7.4990, 52.6);
+  layout["B"] = midgard::PointLL(7.4999, 52.6);
+  layout["1"] = midgard::PointLL(7.49985, 52.60005);
+  layout["C"] = midgard::PointLL(7.5005, 52.6);
+  layout["D"] = midgard::PointLL(7.5015, 52.6);
+  layout["2"] = midgard::PointLL(7.5010, 52.60005);
+  layout["X"] = midgard::PointLL(7.1000, 52.6);
+  layout["Y"] = midgard::PointLL(7.1010, 52.6);
+  layout["3"] = midgard::PointLL(7.1005, 52.60005);
+  gurka::nodes nodes;
+  for (std::string name : {"1", "2", "3"}) {
+    nodes[name] = {{"amenity", "parking_space"}, {"osm_id", "10" + name}};
+  }
+
+  const auto local_level = baldr::TileHierarchy::levels().back().level;
+  auto tile_of = [&](const std::string& name) {
+    return baldr::TileHierarchy::GetGraphId(layout[name], local_level);
+  };
+  ASSERT_NE(tile_of("1"), tile_of("2"));
+
+  auto run_import = [&](const std::string& name, const std::string& cd_name) {
+    auto run_dir = data_dir + "/" + name;
+    std::filesystem::create_directories(run_dir);
+    auto run_conf = conf;
+    run_conf.put("mjolnir.tile_dir", run_dir);
+
+    gurka::ways ways = {
+        {"AB", {{"highway", "residential"}}},
+        {"CD", {{"highway", "residential"}, {"name", cd_name}}},
+        {"XY", {{"highway", "residential"}}},
+    };
+    const auto pbf_file = run_dir + "/map.pbf";
+    gurka::detail::build_pbf(layout, ways, nodes, {}, pbf_file);
+    midgard::logging::Configure({{"type", ""}});
+    mjolnir::build_tile_set(run_conf, {pbf_file}, mjolnir::BuildStage::kInitialize,
+                            mjolnir::BuildStage::kTransit);
+    auto spaces = parking_spaces::read_parking_spaces(run_conf, {pbf_file});
+    return parking_spaces::correlate_parking_spaces(run_conf, spaces);
+  };
+
+  auto first = run_import("first", "Old Street");
+  ASSERT_EQ(first.tiles.size(), 3);
+  EXPECT_TRUE(first.failed.empty());
+
+  // renaming the road in the tile of 2 projects that tile again, and the tile of 1 as well since the
+  // renamed tile is within the search radius of 1
+  auto renamed = run_import("renamed", "New Street");
+  ASSERT_EQ(renamed.tiles.size(), first.tiles.size());
+  for (const auto& tile : renamed.tiles) {
+    EXPECT_EQ(tile.cached, tile.tile_id == tile_of("3")) << tile.tile_id.value;
+  }
+}
+
+TEST(StandAlone, sharded_output) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/sharded_output";
+  std::string base_dir = data_dir + "/base";
+  auto conf = test::make_config(base_dir, {{"mjolnir.concurrency", "2"}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(base_dir);
+
+  // two tile columns, with connections from both sides to way nodes in the other column
+  const std::string ascii_map = R"(
+      A-----B-----C
+      |1 2  |3  4 |
+      | 5   |  6  |
+      D-----E-----F
+      |7   8| 9   |
+      G-----H-----I
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.4998, 52.5002});
+  gurka::ways ways = {
+      {"ABC", {{"highway", "residential"}}}, {"DEF", {{"highway", "residential"}}},
+      {"GHI", {{"highway", "residential"}}}, {"ADG", {{"highway", "residential"}}},
+      {"BEH", {{"highway", "residential"}}}, {"CFI", {{"highway", "residential"}}},
+  };
+
+  gurka::nodes nodes;
+  for (char name = '1'; name <= '9'; ++name) {
+    nodes[std::string(1, name)] = {{"amenity", "parking_space"},
+                                   {"osm_id", std::to_string(100 + name - '0')}};
+  }
+
+  const auto pbf_file = base_dir + "/map.pbf";
+  gurka::detail::build_pbf(layout, ways, nodes, {}, pbf_file);
+  midgard::logging::Configure({{"type", ""}});
+  mjolnir::build_tile_set(conf, {pbf_file}, mjolnir::BuildStage::kInitialize,
+                          mjolnir::BuildStage::kTransit);
+
+  auto single_dir = data_dir + "/single";
+  std::filesystem::copy(base_dir, single_dir, std::filesystem::copy_options::recursive);
+  auto single_conf = conf;
+  single_conf.put("mjolnir.tile_dir", single_dir);
+  parking_spaces::process_parking_spaces(single_conf, pbf_file);
+  const auto expected = read_graph_tiles(single_dir);
+
+  for (size_t shards : {2, 3}) {
+    auto run_dir = data_dir + "/shards_" + std::to_string(shards);
+    std::filesystem::copy(base_dir, run_dir, std::filesystem::copy_options::recursive);
+    std::filesystem::copy(base_dir, run_dir + "_pristine", std::filesystem::copy_options::recursive);
+
+    auto run_conf = conf;
+    run_conf.put("mjolnir.tile_dir", run_dir);
+    run_conf.put("parking_spaces.parse_only", true);
+    parking_spaces::process_parking_spaces(run_conf, pbf_file);
+    run_conf.erase("parking_spaces");
+
+    // the shards only write their own tiles, so together they produce the same tiles as a
+    // single import, whatever order they run in
+    size_t indexed = 0;
+    for (size_t shard = shards; shard > 0; --shard) {
+      run_conf.put("parking_spaces.shard", std::format("{}/{}", shard, shards));
+      parking_spaces::process_parking_spaces(run_conf, std::vector<std::string>{});
+      indexed +=
+          parking_spaces::parking_index(std::format("{}/parking_index_{}.bin", run_dir, shard))
+              .size();
+    }
+    EXPECT_EQ(indexed, nodes.size());
+
+    auto tiles = read_graph_tiles(run_dir);
+    ASSERT_EQ(tiles.size(), expected.size());
+    for (const auto& [name, bytes] : expected) {
+      EXPECT_TRUE(tiles[name] == bytes) << name << " differs with " << shards << " shards";
+    }
+  }
+}
+
+TEST(StandAlone, journal) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/journal";
+  std::string tile_dir = data_dir + "/tiles";
+  std::string journal_dir = data_dir + "/tiles_journal";
+  auto conf = test::make_config(tile_dir, {{"mjolnir.concurrency", "2"},
+                                           {"parking_spaces.journal", "true"}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(tile_dir);
+
+  const std::string ascii_map = R"(
+      A-----B-----C
+      |1 2  |3  4 |
+      D-----E-----F
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.4998, 52.5002});
+  gurka::ways ways = {
+      {"ABC", {{"highway", "residential"}}}, {"DEF", {{"highway", "residential"}}},
+      {"AD", {{"highway", "residential"}}},  {"BE", {{"highway", "residential"}}},
+      {"CF", {{"highway", "residential"}}},
+  };
+  gurka::nodes nodes;
+  for (char name = '1'; name <= '4'; ++name) {
+    nodes[std::string(1, name)] = {{"amenity", "parking_space"},
+                                   {"osm_id", std::to_string(100 + name - '0')}};
+  }
+
+  const auto pbf_file = data_dir + "/map.pbf";
+  gurka::detail::build_pbf(layout, ways, nodes, {}, pbf_file);
+  midgard::logging::Configure({{"type", ""}});
+  mjolnir::build_tile_set(conf, {pbf_file}, mjolnir::BuildStage::kInitialize,
+                          mjolnir::BuildStage::kTransit);
+  const auto base_tiles = read_graph_tiles(tile_dir);
+
+  // the journal of an import of other parking spaces is not resumed
+  std::filesystem::create_directories(journal_dir);
+  std::ofstream(journal_dir + "/journal.log") << "parking_spaces journal 1 0000000000000000\n1 0\n";
+  EXPECT_THROW(parking_spaces::process_parking_spaces(conf, pbf_file), std::runtime_error);
+  EXPECT_TRUE(read_graph_tiles(tile_dir) == base_tiles);
+
+  // a completed import removes its journal
+  std::filesystem::remove_all(journal_dir);
+  parking_spaces::process_parking_spaces(conf, pbf_file);
+  EXPECT_FALSE(std::filesystem::exists(journal_dir));
+  EXPECT_FALSE(read_graph_tiles(tile_dir) == base_tiles);
+  EXPECT_EQ(parking_spaces::parking_index(tile_dir + "/parking_index.bin").size(), nodes.size());
+}
+
+TEST(StandAlone, journal_resume) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/journal_resume";
+  std::string base_dir = data_dir + "/base";
+  auto conf = test::make_config(base_dir, {{"mjolnir.concurrency", "2"},
+                                           {"parking_spaces.journal", "true"}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(base_dir);
+
+  // four tiles, with parking spaces connecting to way nodes in the neighbouring tiles
+  const std::string ascii_map = R"(
+      A-----B-----C
+      |1 2  |3  4 |
+      | 5   |  6  |
+      D-----E-----F
+      |7   8| 9   |
+      G-----H-----I
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.4998, 52.5002});
+  gurka::ways ways = {
+      {"ABC", {{"highway", "residential"}}}, {"DEF", {{"highway", "residential"}}},
+      {"GHI", {{"highway", "residential"}}}, {"ADG", {{"highway", "residential"}}},
+      {"BEH", {{"highway", "residential"}}}, {"CFI", {{"highway", "residential"}}},
+  };
+  gurka::nodes nodes;
+  for (char name = '1'; name <= '9'; ++name) {
+    nodes[std::string(1, name)] = {{"amenity", "parking_space"},
+                                   {"osm_id", std::to_string(100 + name - '0')}};
+  }
+
+  const auto pbf_file = base_dir + "/map.pbf";
+  gurka::detail::build_pbf(layout, ways, nodes, {}, pbf_file);
+  midgard::logging::Configure({{"type", ""}});
+  mjolnir::build_tile_set(conf, {pbf_file}, mjolnir::BuildStage::kInitialize,
+                          mjolnir::BuildStage::kTransit);
+
+  auto read_file = [](const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  };
+
+  // what the resumed imports have to end up with
+  auto import_into = [&](const std::string& name) {
+    auto run_conf = conf;
+    run_conf.put("mjolnir.tile_dir", data_dir + "/" + name);
+    return run_conf;
+  };
+  std::filesystem::copy(base_dir, data_dir + "/expected", std::filesystem::copy_options::recursive);
+  parking_spaces::process_parking_spaces(import_into("expected"), pbf_file);
+  const auto expected = read_graph_tiles(data_dir + "/expected");
+  const auto expected_index = read_file(data_dir + "/expected/parking_index.bin");
+
+  // an import that dies right before writing the parking index leaves its whole journal behind:
+  // the snapshots of the tiles before each phase, the spill files and the log of both phases
+  const auto crashed_dir = data_dir + "/crashed";
+  const auto crashed_journal = crashed_dir + "_journal";
+  std::filesystem::copy(base_dir, crashed_dir, std::filesystem::copy_options::recursive);
+  auto crashed_conf = import_into("crashed");
+  crashed_conf.put("parking_spaces.index", data_dir + "/missing/parking_index.bin");
+  EXPECT_THROW(parking_spaces::process_parking_spaces(crashed_conf, pbf_file), std::runtime_error);
+
+  std::ifstream log(crashed_journal + "/journal.log");
+  std::string header;
+  ASSERT_TRUE(std::getline(log, header));
+  std::vector<uint64_t> logged[2];
+  int logged_phase = 0;
+  uint64_t logged_tile = 0;
+  while (log >> logged_phase >> logged_tile) {
+    logged[logged_phase - 1].push_back(logged_tile);
+  }
+  ASSERT_GT(logged[0].size(), 1);
+  ASSERT_GT(logged[1].size(), 1);
+  auto suffix = [](uint64_t tile) { return baldr::GraphTile::FileSuffix(baldr::GraphId(tile)); };
+
+  // take the crashed import back to where it would have been, had it died halfway through phase 1
+  // or phase 2
+  for (int phase : {1, 2}) {
+    const auto run_dir = std::format("{}/phase_{}", data_dir, phase);
+    const auto journal_dir = run_dir + "_journal";
+    std::filesystem::copy(crashed_dir, run_dir, std::filesystem::copy_options::recursive);
+    std::filesystem::copy(crashed_journal, journal_dir, std::filesystem::copy_options::recursive);
+
+    const auto& interrupted = logged[phase - 1];
+    const auto committed = interrupted.size() / 2;
+    std::ofstream rewritten(journal_dir + "/journal.log", std::ios::trunc);
+    rewritten << header << '\n';
+    if (phase == 2) {
+      for (auto tile : logged[0]) {
+        rewritten << "1 " << tile << '\n';
+      }
+    }
+    for (size_t i = 0; i < committed; ++i) {
+      rewritten << phase << ' ' << interrupted[i] << '\n';
+    }
+    // the process died while logging the next tile, before the line was complete
+    rewritten << phase << ' ' << interrupted[committed];
+    rewritten.close();
+
+    // tiles that were not committed in phase 2 are as they were before it
+    const auto phase_2_start = logged[1].begin() + (phase == 2 ? committed : 0);
+    for (auto tile = phase_2_start; tile != logged[1].end(); ++tile) {
+      std::filesystem::copy_file(journal_dir + "/phase2/" + suffix(*tile),
+                                 run_dir + "/" + suffix(*tile),
+                                 std::filesystem::copy_options::overwrite_existing);
+    }
+    if (phase == 1) {
+      std::filesystem::remove_all(journal_dir + "/phase2");
+      for (auto tile = interrupted.begin() + committed; tile != interrupted.end(); ++tile) {
+        std::filesystem::copy_file(base_dir + "/" + suffix(*tile), run_dir + "/" + suffix(*tile),
+                                   std::filesystem::copy_options::overwrite_existing);
+      }
+    }
+
+    // and the tile that was being built is left half written in the staging directory
+    const auto staged = journal_dir + "/staging/" + suffix(interrupted[committed]);
+    std::filesystem::create_directories(std::filesystem::path(staged).parent_path());
+    std::ofstream(staged) << "half a tile";
+
+    // the resumed import skips the committed tiles, takes their parking nodes from the spill files
+    // and must not add any parking node twice
+    parking_spaces::process_parking_spaces(import_into(std::format("phase_{}", phase)), pbf_file);
+    EXPECT_FALSE(std::filesystem::exists(journal_dir));
+    auto tiles = read_graph_tiles(run_dir);
+    ASSERT_EQ(tiles.size(), expected.size());
+    for (const auto& [name, bytes] : expected) {
+      EXPECT_TRUE(tiles[name] == bytes) << name << " differs when resumed in phase " << phase;
+    }
+    EXPECT_TRUE(read_file(run_dir + "/parking_index.bin") == expected_index)
+        << "the parking index differs when resumed in phase " << phase;
+  }
+}
+
+TEST(StandAlone, tile_extract) {
+
+  std::string data_dir = PS_BUILD_DIR "/test/data/tile_extract";
+  std::string base_dir = data_dir + "/base";
+  auto conf = test::make_config(base_dir, {{"mjolnir.concurrency", "2"}});
+
+  std::filesystem::remove_all(data_dir);
+  std::filesystem::create_directories(base_dir);
+
+  const std::string ascii_map = R"(
+      A-----B-----C
+      |1 2  |3  4 |
+      D-----E-----F
+    )";
+  auto layout = gurka::detail::map_to_coordinates(ascii_map, 10, {7.4998, 52.5002});
+  // a road in a tile without parking spaces, which an extract patch leaves out
+  layout["X"] = midgard::PointLL(7.8, 52.6);
+  layout["Y"] = midgard::PointLL(7.801, 52.6);
+  gurka::ways ways = {
+      {"ABC", {{"highway", "residential"}}}, {"DEF", {{"highway", "residential"}}},
+      {"AD", {{"highway", "residential"}}},  {"BE", {{"highway", "residential"}}},
+      {"CF", {{"highway", "residential"}}},  {"XY", {{"highway", "residential"}}},
+  };
+  gurka::nodes nodes;
+  for (char name = '1'; name <= '4'; ++name) {
+    nodes[std::string(1, name)] = {{"amenity", "parking_space"},
+                                   {"osm_id", std::to_string(100 + name - '0')}};
+  }
+
+  const auto pbf_file = data_dir + "/map.pbf";
+  gurka::detail::build_pbf(layout, ways, nodes, {}, pbf_file);
+  midgard::logging::Configure({{"type", ""}});
+  mjolnir::build_tile_set(conf, {pbf_file}, mjolnir::BuildStage::kInitialize,
+                          mjolnir::BuildStage::kTransit);
+  const auto base_tiles = read_graph_tiles(base_dir);
+  ASSERT_GT(base_tiles.size(), 2);
+  const auto input_extract = data_dir + "/tiles.tar";
+  write_tile_extract(base_tiles, input_extract);
+
+  // the extract has to hold the same tiles as an import into the tile directory
+  auto dir_conf = conf;
+  dir_conf.put("mjolnir.tile_dir", data_dir + "/dir");
+  std::filesystem::copy(base_dir, data_dir + "/dir", std::filesystem::copy_options::recursive);
+  parking_spaces::process_parking_spaces(dir_conf, pbf_file);
+  const auto expected = read_graph_tiles(data_dir + "/dir");
+
+  auto extract_conf = conf;
+  extract_conf.put("mjolnir.tile_dir", data_dir + "/extract");
+  extract_conf.put("mjolnir.tile_extract", input_extract);
+  std::filesystem::create_directories(data_dir + "/extract");
+
+  // without an output extract the tiles read and written would belong to different tile sets
+  EXPECT_THROW(parking_spaces::process_parking_spaces(extract_conf, pbf_file), std::runtime_error);
+
+  const auto output_extract = data_dir + "/tiles_parking.tar";
+  extract_conf.put("parking_spaces.output_extract", output_extract);
+  parking_spaces::process_parking_spaces(extract_conf, pbf_file);
+  auto tiles = read_tile_extract(output_extract);
+  ASSERT_EQ(tiles.size(), expected.size());
+  for (const auto& [name, bytes] : expected) {
+    EXPECT_TRUE(tiles[name] == bytes) << name << " differs in the extract";
+  }
+
+  // the graph reader takes the output extract as it is
+  {
+    auto mjolnir = extract_conf.get_child("mjolnir");
+    mjolnir.put("tile_extract", output_extract);
+    auto reader = test::make_clean_graphreader(mjolnir);
+    for (const auto& [name, bytes] : expected) {
+      auto tile = reader->GetGraphTile(baldr::GraphTile::GetTileId(name));
+      ASSERT_TRUE(tile) << name;
+      EXPECT_TRUE(std::string(reinterpret_cast<const char*>(tile->header()),
+                              tile->header()->end_offset()) == bytes)
+          << name << " differs when read from the extract";
+    }
+  }
+
+  // a patch holds the modified tiles only
+  const auto patch_extract = data_dir + "/tiles_patch.tar";
+  extract_conf.put("parking_spaces.output_extract", patch_extract);
+  extract_conf.put("parking_spaces.patch_extract", true);
+  parking_spaces::process_parking_spaces(extract_conf, pbf_file);
+  auto patch = read_tile_extract(patch_extract);
+  EXPECT_FALSE(patch.empty());
+  EXPECT_LT(patch.size(), expected.size());
+  for (const auto& [name, bytes] : patch) {
+    ASSERT_TRUE(expected.count(name)) << name;
+    EXPECT_TRUE(bytes == expected.at(name)) << name << " differs in the patch";
+  }
+  for (const auto& [name, bytes] : expected) {
+    if (bytes != base_tiles.at(name)) {
+      EXPECT_TRUE(patch.count(name)) << name << " is missing from the patch";
+    }
+  }
+  const auto untouched = baldr::GraphTile::FileSuffix(
+      baldr::TileHierarchy::GetGraphId(layout["X"], baldr::TileHierarchy::levels().back().level));
+  EXPECT_FALSE(patch.count(untouched));
+
+  // an entry with a long name has a record in front of its header which finish() would lose, so
+  // the extract is refused before anything is imported
+  auto long_name_tiles = base_tiles;
+  long_name_tiles[std::string(120, 'x') + "/README"] = "not a tile";
+  const auto long_name_extract = data_dir + "/tiles_long_name.tar";
+  write_tile_extract(long_name_tiles, long_name_extract);
+  extract_conf.put("mjolnir.tile_extract", long_name_extract);
+  extract_conf.put("parking_spaces.output_extract", data_dir + "/tiles_long_name_parking.tar");
+  EXPECT_THROW(parking_spaces::process_parking_spaces(extract_conf, pbf_file), std::runtime_error);
+  EXPECT_FALSE(std::filesystem::exists(data_dir + "/tiles_long_name_parking.tar"));
+}
+
 TEST(StandAlone, pathfinding) {
 
   std::string data_dir = PS_BUILD_DIR "/test/data/parse_nodes_routing";
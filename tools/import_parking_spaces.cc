@@ -4,6 +4,8 @@
 
 #include <boost/property_tree/ptree.hpp>
 
+#include <iostream>
+
 int main(int argc, char* argv[]) {
   const auto program = std::filesystem::path(__FILE__).stem().string();
   // args
@@ -13,17 +15,74 @@ int main(int argc, char* argv[]) {
       options(program,
               "Parse nodes marked as amenity=parking_space and correlate them to a Valhalla graph");
   auto add_opt = options.add_options();
-  add_opt("input", "Input .pbf", cxxopts::value<std::string>());
+  add_opt("input", "Input .pbf files", cxxopts::value<std::vector<std::string>>());
   add_opt("h,help", "Print this help message.");
   add_opt("v,version", "Print the version of this software.");
   add_opt("c,config", "Path to the configuration file", cxxopts::value<std::string>());
   add_opt("i,inline-config", "Inline JSON config", cxxopts::value<std::string>());
+  add_opt("tile-extract", "Read tiles from this tar extract instead of mjolnir.tile_dir",
+          cxxopts::value<std::string>());
+  add_opt("output-extract", "Write the modified tile set to this tar extract",
+          cxxopts::value<std::string>());
+  add_opt("patch-extract", "Only write the modified tiles to the output extract");
+  add_opt("t,type", "The kind of parking to import: car, bicycle or motorcycle",
+          cxxopts::value<std::string>());
+  add_opt("dry-run", "Project the parking spaces without modifying any tiles");
+  add_opt("geojson", "Write the projection results to this GeoJSON file",
+          cxxopts::value<std::string>());
+  add_opt("parse-only", "Only parse the input files, for sharded imports to share");
+  add_opt("shard", "Only import the tiles of one shard, like 2/8, from the output of --parse-only",
+          cxxopts::value<std::string>());
+  add_opt("pristine-dir", "The unmodified tile set sharded imports read from",
+          cxxopts::value<std::string>());
+  add_opt("remove", "Remove the parking spaces of a previous import from the tiles");
+  add_opt("reimport", "Remove the parking spaces of a previous import before importing");
+  add_opt("projection-cache", "Reuse the projections of earlier imports kept in this directory",
+          cxxopts::value<std::string>());
 
   options.parse_positional({"input"});
-  options.positional_help("[INPUT_OSM_FILE]");
+  options.positional_help("[INPUT_OSM_FILES]");
   auto result = options.parse(argc, argv);
   if (!parse_common_args(program, options, result, &config, "mjolnir.logging", true))
     return EXIT_SUCCESS;
 
-  parking_spaces::process_parking_spaces(config, result["input"].as<std::string>());
+  if (result.count("tile-extract"))
+    config.put("mjolnir.tile_extract", result["tile-extract"].as<std::string>());
+  if (result.count("output-extract"))
+    config.put("parking_spaces.output_extract", result["output-extract"].as<std::string>());
+  if (result.count("patch-extract"))
+    config.put("parking_spaces.patch_extract", true);
+  if (result.count("type"))
+    config.put("parking_spaces.type", result["type"].as<std::string>());
+  if (result.count("dry-run"))
+    config.put("parking_spaces.dry_run", true);
+  if (result.count("geojson"))
+    config.put("parking_spaces.geojson", result["geojson"].as<std::string>());
+  if (result.count("parse-only"))
+    config.put("parking_spaces.parse_only", true);
+  if (result.count("shard"))
+    config.put("parking_spaces.shard", result["shard"].as<std::string>());
+  if (result.count("pristine-dir"))
+    config.put("parking_spaces.pristine_dir", result["pristine-dir"].as<std::string>());
+  if (result.count("remove"))
+    config.put("parking_spaces.remove", true);
+  if (result.count("reimport"))
+    config.put("parking_spaces.reimport", true);
+  if (result.count("projection-cache"))
+    config.put("parking_spaces.projection_cache", result["projection-cache"].as<std::string>());
+
+  if (result.count("tile-extract") && !result.count("output-extract") &&
+      !result.count("dry-run")) {
+    std::cerr << "--tile-extract requires --output-extract, unless it is a dry run" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (result.count("input")) {
+    input_files = result["input"].as<std::vector<std::string>>();
+  } else if (!result.count("shard") && !result.count("remove")) {
+    std::cerr << "Input OSM files are required, unless importing a shard or removing" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  parking_spaces::process_parking_spaces(config, input_files);
 }
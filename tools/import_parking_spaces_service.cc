@@ -0,0 +1,203 @@
+#include "argparse_utils.h"
+#include "cxxopts.hpp"
+#include "parking_spaces/correlation.h"
+#include "parking_spaces/parking_spaces.h"
+
+#include <valhalla/midgard/logging.h>
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <prime_server/http_protocol.hpp>
+#include <prime_server/prime_server.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <functional>
+#include <sstream>
+#include <thread>
+
+using namespace prime_server;
+
+namespace {
+
+const headers_t::value_type kJsonMime{"Content-type", "application/json;charset=utf-8"};
+
+parking_spaces::parking_change::action parse_action(const std::string& action) {
+  if (action == "add") {
+    return parking_spaces::parking_change::action::add;
+  } else if (action == "move") {
+    return parking_spaces::parking_change::action::move;
+  } else if (action == "delete") {
+    return parking_spaces::parking_change::action::remove;
+  }
+  throw std::invalid_argument("Unknown action: " + action);
+}
+
+/**
+ * Parses a batch of changes like
+ *   {"changes": [{"action": "add", "osm_id": 1, "lat": 52.5, "lon": 7.5, "level": "1"},
+ *                {"action": "delete", "osm_id": 2}]}
+ * where move takes the same fields as add, and level and osm_type ("node" or "way", for parking
+ * spaces mapped as ways at their representative point) are optional.
+ */
+std::vector<parking_spaces::parking_change> parse_changes(const std::string& body) {
+  boost::property_tree::ptree request;
+  std::stringstream stream(body);
+  boost::property_tree::read_json(stream, request);
+
+  std::vector<parking_spaces::parking_change> changes;
+  for (const auto& [_, item] : request.get_child("changes")) {
+    parking_spaces::parking_change change;
+    change.type = parse_action(item.get<std::string>("action"));
+    change.space.node = valhalla::mjolnir::OSMNode{item.get<uint64_t>("osm_id")};
+    if (item.get<std::string>("osm_type", "node") == "way") {
+      change.space.type = parking_spaces::osm_type::way;
+    }
+    change.space.level = parking_spaces::kInvalidLevel;
+    change.space.level_precision = 0.f;
+
+    if (change.type != parking_spaces::parking_change::action::remove) {
+      change.space.node.set_latlng(item.get<double>("lon"), item.get<double>("lat"));
+      if (auto level = item.get_optional<std::string>("level")) {
+        change.space.level = std::stof(*level);
+        auto dot = level->find('.');
+        change.space.level_precision = dot == std::string::npos ? 0.f : level->size() - dot - 1;
+      }
+    }
+    changes.push_back(change);
+  }
+  return changes;
+}
+
+/**
+ * @return the parking spaces as a JSON list of {"osm_id", "osm_type"}, from their
+ *         parking_space_key, as node and way ids overlap
+ */
+std::string format_ids(const std::vector<uint64_t>& keys) {
+  std::string list;
+  for (auto key : keys) {
+    auto [osm_id, type] = parking_spaces::split_parking_space_key(key);
+    list += std::format(R"({}{{"osm_id":{},"osm_type":"{}"}})", list.empty() ? "" : ",", osm_id,
+                        type == parking_spaces::osm_type::way ? "way" : "node");
+  }
+  return "[" + list + "]";
+}
+
+worker_t::result_t respond(http_request_info_t& info, unsigned code, const std::string& body) {
+  worker_t::result_t result{false, {}, ""};
+  http_response_t response(code, code == 200 ? "OK" : "Bad Request", body, headers_t{kJsonMime});
+  response.from_info(info);
+  result.messages.emplace_back(response.to_string());
+  return result;
+}
+
+/**
+ * Handles POST /patch with a batch of changes and GET /status
+ */
+worker_t::result_t work(parking_spaces::tile_patcher& patcher,
+                        const std::list<zmq::message_t>& job,
+                        void* request_info) {
+  auto& info = *static_cast<http_request_info_t*>(request_info);
+  try {
+    auto request = http_request_t::from_string(static_cast<const char*>(job.front().data()),
+                                               job.front().size());
+
+    if (request.path == "/status") {
+      return respond(info, 200, std::format(R"({{"parking_spaces":{}}})", patcher.size()));
+    }
+    if (request.path != "/patch" || request.method != method_t::POST) {
+      return respond(info, 400, R"({"error":"Expected POST /patch or GET /status"})");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto changes = parse_changes(request.body);
+    auto result = patcher.apply(changes);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    LOG_INFO("Applied {} changes to {} tiles in {:.1f}ms", changes.size(), result.tiles,
+             elapsed.count());
+    return respond(info, 200,
+                   std::format(R"({{"changes":{},"tiles":{},"failed":{},"rejected":{},"ms":{:.1f}}})",
+                               changes.size(), result.tiles, format_ids(result.failed),
+                               format_ids(result.rejected), elapsed.count()));
+  } catch (const std::exception& e) {
+    LOG_ERROR("Failed to apply changes: {}", e.what());
+    std::string message = e.what();
+    std::replace(message.begin(), message.end(), '"', '\'');
+    return respond(info, 400, std::format(R"({{"error":"{}"}})", message));
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  const auto program = std::filesystem::path(__FILE__).stem().string();
+  // args
+  boost::property_tree::ptree config;
+  cxxopts::Options options(program,
+                           "Keep parking spaces correlated to a Valhalla graph and patch the "
+                           "affected tiles when single parking spaces change");
+  auto add_opt = options.add_options();
+  add_opt("input", "Input .pbf files with the initial parking spaces",
+          cxxopts::value<std::vector<std::string>>());
+  add_opt("h,help", "Print this help message.");
+  add_opt("v,version", "Print the version of this software.");
+  add_opt("c,config", "Path to the configuration file", cxxopts::value<std::string>());
+  add_opt("i,inline-config", "Inline JSON config", cxxopts::value<std::string>());
+  add_opt("listen", "The endpoint to accept requests on",
+          cxxopts::value<std::string>()->default_value("ipc:///tmp/parking_spaces"));
+  add_opt("pristine-dir",
+          "The tile set without parking spaces, copied from mjolnir.tile_dir on first start",
+          cxxopts::value<std::string>());
+
+  options.parse_positional({"input"});
+  options.positional_help("[INPUT_OSM_FILES]");
+  auto result = options.parse(argc, argv);
+  if (!parse_common_args(program, options, result, &config, "mjolnir.logging"))
+    return EXIT_SUCCESS;
+
+  auto pristine_dir = result.count("pristine-dir")
+                          ? result["pristine-dir"].as<std::string>()
+                          : config.get<std::string>("mjolnir.tile_dir") + "_pristine";
+  parking_spaces::tile_patcher patcher(config, pristine_dir);
+
+  // the initial import is a single batch adding every parking space of the input
+  if (result.count("input")) {
+    std::vector<parking_spaces::parking_change> changes;
+    auto input = result["input"].as<std::vector<std::string>>();
+    for (const auto& space : parking_spaces::read_parking_spaces(config, input)) {
+      changes.push_back({parking_spaces::parking_change::action::add, space});
+    }
+    auto loaded = patcher.apply(changes);
+    LOG_INFO("Imported {} parking spaces into {} tiles, {} failed", patcher.size(), loaded.tiles,
+             loaded.failed.size());
+  }
+
+  // a single worker applies the batches one after another, as the tiles are shared between them
+  auto listen = result["listen"].as<std::string>();
+  auto proxy_endpoint = listen + "_proxy";
+  auto result_endpoint = listen + "_results";
+  auto interrupt_endpoint = listen + "_interrupt";
+
+  zmq::context_t context;
+  server_t<http_request_t, http_request_info_t> server(context, listen, proxy_endpoint + "_upstream",
+                                                       result_endpoint, interrupt_endpoint, true);
+  proxy_t proxy(context, proxy_endpoint + "_upstream", proxy_endpoint + "_downstream");
+  worker_t worker(
+      context, proxy_endpoint + "_downstream", "ipc:///dev/null", result_endpoint,
+      interrupt_endpoint,
+      [&patcher](const std::list<zmq::message_t>& job, void* request_info,
+                 worker_t::interrupt_function_t&) { return work(patcher, job, request_info); },
+      [] {});
+
+  std::thread server_thread(std::bind(&server_t<http_request_t, http_request_info_t>::serve,
+                                      std::ref(server)));
+  std::thread proxy_thread(std::bind(&proxy_t::forward, std::ref(proxy)));
+  LOG_INFO("Listening on {}", listen);
+  worker.work();
+
+  server_thread.join();
+  proxy_thread.join();
+  return EXIT_SUCCESS;
+}